@@ -16,6 +16,7 @@
 #include <atomic>
 #include <cstdlib>
 #include <exception>
+#include <functional>
 
 // naming of the local variable:
 // to world/Amazon verb(pickup, load, ...) req
@@ -31,12 +32,12 @@ void UPS::queryTruck(int truckid)
         // (2) add UQuery to UCommands
         // (3) send UCommands to world
         // (4) record sent message
-        int seqNum = seqGenerator->getSeqNumber();
+        int seqNum = seqGenerator->getSeqNumber(WORLD_PEER);
         UQuery toWorldQueryTruckReq = DataGenerator::getInstance()->genUQuery(truckid, seqNum);
         UCommands toWorldQueryTruckReqCommand;
         DataGenerator::getInstance()->addUQuery(toWorldQueryTruckReqCommand, toWorldQueryTruckReq);
-        worldSocket->sendMsg(toWorldQueryTruckReqCommand);
         seqGenerator->addSentMessage(seqNum, toWorldQueryTruckReq);
+        worldWriter->post(toWorldQueryTruckReqCommand);
         Logger::getInstance()->log("world.log", "Send world to query truck status:\n", toWorldQueryTruckReqCommand.DebugString());
     }
     catch(std::exception & e)
@@ -47,33 +48,74 @@ void UPS::queryTruck(int truckid)
 
 void UPS::handleTruckStatusQuery(const UTruck truckStatusQueryRes)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = truckStatusQueryRes.seqnum();
+    if(!claimRequest(WORLD_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
-        // check received sequence number, or send ack message to Amazon
-        int recv_seq = truckStatusQueryRes.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
-        {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToWorld(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
         Logger::getInstance()->log("world.txt", "Receive truck status query result:\n", truckStatusQueryRes.DebugString());
     }
     catch(std::exception & e)
     {
         Logger::getInstance()->log("error.txt", "handleTruckStatusQuery() error");
     }
+    completeRequest(WORLD_PEER, recv_seq);
+}
+
+// claim a request received from peer, false if it has been handled or is being handled already
+bool UPS::claimRequest(int peer, int64_t seqNum)
+{
+    if(seqGenerator->tryClaim(peer, seqNum))
+    {
+        return true;
+    }
+    // retransmitted copy, our ack may have been lost, ack again if the first copy is handled durably,
+    // a copy still being handled is ack-ed once it completes
+    if(!seqGenerator->isInFlight(peer, seqNum))
+    {
+        sendAckMessage(peer, seqNum);
+    }
+    Logger::getInstance()->log(peer == WORLD_PEER ? "world.log" : "amazon.log", "Sequence number ", seqNum, " already handled");
+    return false;
+}
+
+// the claimed request has been handled(or failed and is dropped), and its effects are durable,
+// record it as handled, and ack it once the record is on disk; until then a retransmitted copy is not ack-ed
+void UPS::completeRequest(int peer, int64_t seqNum)
+{
+    seqGenerator->completeClaim(peer, seqNum, std::bind(&UPS::sendAckMessage, this, peer, seqNum));
+}
+
+// the claimed request lost its database write, it's neither recorded as handled nor ack-ed,
+// so the peer retransmits it and the copy is handled again
+void UPS::releaseRequest(int peer, int64_t seqNum)
+{
+    seqGenerator->releaseClaim(peer, seqNum);
+    Logger::getInstance()->log(peer == WORLD_PEER ? "world.log" : "amazon.log", "Sequence number ", seqNum, " released, wait for retransmission");
+}
+
+void UPS::sendAckMessage(int peer, unsigned seqNum)
+{
+    if(peer == WORLD_PEER)
+    {
+        sendAckMessageToWorld(seqNum);
+    }
+    else
+    {
+        sendAckMessageToAmazon(seqNum);
+    }
 }
 
 void UPS::sendAckMessageToAmazon(unsigned seqNum)
 {
     try
     {
-        UtoACommand toAmazonAckCommand;
-        DataGenerator::getInstance()->addSeqNumberToAmazonCommand(toAmazonAckCommand, seqNum);
-        amazonSocket->sendMsg(toAmazonAckCommand);
-        Logger::getInstance()->log("amazon.log", "send ack to amazon\n", toAmazonAckCommand.DebugString());
+        // piggybacked on the next command to amazon, or sent alone after ACK_DELAY_MS
+        amazonWriter->postAck(seqNum);
+        Logger::getInstance()->log("amazon.log", "send ack to amazon: ", seqNum);
     }
     catch(std::exception & e)
     {
@@ -85,10 +127,9 @@ void UPS::sendAckMessageToWorld(unsigned seqNum)
 {
     try
     {
-        UCommands toWorldAckCommand;
-        DataGenerator::getInstance()->addSeqNumberToWorldCommand(toWorldAckCommand, seqNum);
-        worldSocket->sendMsg(toWorldAckCommand);
-        Logger::getInstance()->log("world.log", "send ack to world\n", toWorldAckCommand.DebugString());
+        // piggybacked on the next command to world, or sent alone after ACK_DELAY_MS
+        worldWriter->postAck(seqNum);
+        Logger::getInstance()->log("world.log", "send ack to world: ", seqNum);
     }
     catch(std::exception & e)
     {
@@ -99,20 +140,16 @@ void UPS::sendAckMessageToWorld(unsigned seqNum)
 // receive user validation request from Amazon
 void UPS::handleUserValidationReq(const UserValidationRequest fromAmazonUserValidationReq)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = fromAmazonUserValidationReq.seqnum();
+    if(!claimRequest(AMAZON_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
         Logger::getInstance()->log("amazon.log", "Received from Amazon on user validation:\n", fromAmazonUserValidationReq.DebugString());
 
-        // check received sequence number, or send ack message to Amazon
-        int recv_seq = fromAmazonUserValidationReq.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
-        {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToAmazon(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
-        
         // (1) generate UserValidationResponse
         // (2) add UserValidationResponse to AtoUCommand
         // (3) send AtoUCommand to Amazon
@@ -122,7 +159,7 @@ void UPS::handleUserValidationReq(const UserValidationRequest fromAmazonUserVali
         std::string account = fromAmazonUserValidationReq.upsaccount();
         int shipid = fromAmazonUserValidationReq.shipid();
         bool isAccountValid = dbConn->checkAccount(account);
-        int seqNum = seqGenerator->getSeqNumber();
+        int seqNum = seqGenerator->getSeqNumber(AMAZON_PEER);
         UserValidationResponse toAmazonUserValidationRes = DataGenerator::getInstance()->genUserValidationResponse(isAccountValid, shipid, seqNum);
         UtoACommand toAmazonUserValidationResCommand;
         DataGenerator::getInstance()->addUserValidationResponse(toAmazonUserValidationResCommand, toAmazonUserValidationRes);
@@ -131,44 +168,60 @@ void UPS::handleUserValidationReq(const UserValidationRequest fromAmazonUserVali
         std::cout << "ready to send message to world at handleUserValidationReq\n============================================================" << std::endl;
         std::cout << toAmazonUserValidationResCommand.DebugString() << std::endl;
 
-        amazonSocket->sendMsg(toAmazonUserValidationResCommand);
         seqGenerator->addSentMessage(seqNum, toAmazonUserValidationRes);
+        amazonWriter->post(toAmazonUserValidationResCommand);
         Logger::getInstance()->log("amazon.log", "Respond to Amazon user validation request:\n", toAmazonUserValidationResCommand.DebugString());
     }
     catch(std::exception & e)
     {
         Logger::getInstance()->log("error.txt", "sendAckMessageToWorld() error");
     }   
+    completeRequest(AMAZON_PEER, recv_seq);
 }
 
-// receive from Amazon to pick up, ask world to pick up
+// receive from Amazon to pick up, assign a truck to the warehouse
 void UPS::handlePickupReq(const AtoUPickupRequest fromAmazonPickUpReq)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = fromAmazonPickUpReq.seqnum();
+    if(!claimRequest(AMAZON_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
         Logger::getInstance()->log("amazon.log", "Received from Amazon on pick up\n", fromAmazonPickUpReq.DebugString());
 
-        // check received sequence number, or send ack message to Amazon
-        int recv_seq = fromAmazonPickUpReq.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
+        // pick a truck for the warehouse, everything touching the truck afterwards runs on its lane,
+        // in order with world events of the same truck; if no truck is free, the pickup is queued in
+        // the truck pool and dispatched by the lane of the next truck returned, no worker waits for it
+        int warehouseid = fromAmazonPickUpReq.warehouseid();
+        truckPool->requestTruck(warehouseid, [this, fromAmazonPickUpReq](int truckid)
         {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToAmazon(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
-        
+            truckLanes->submit(truckid, std::bind(&UPS::dispatchTruckToPickup, this, truckid, fromAmazonPickUpReq));
+        });
+        return; // completed by dispatchTruckToPickup()
+    }
+    catch(std::exception & e)
+    {
+        Logger::getInstance()->log("error.log", "handlePickupReq() error");
+    }
+    completeRequest(AMAZON_PEER, recv_seq);
+}
+
+// run on the lane of the assigned truck, ask world to pick up
+void UPS::dispatchTruckToPickup(int truckid, const AtoUPickupRequest fromAmazonPickUpReq)
+{
+    try
+    {
         // (1) generate UGoPickup
         // (2) set truck status: warehouse id and package id
         // (3) add simulation speed to UCommands
         // (4) add UGoPickup to UCommands
         // (5) send Ucommands to world
-        // (6) send ack message to Amazon
-        // (7) record handled message
-        // (8) record sent message
+        // (6) record sent message
         int warehouseid = fromAmazonPickUpReq.warehouseid();
-        int truckid = truckPool->getFreeTruck(warehouseid);
-        int seqNum = seqGenerator->getSeqNumber();
+        int seqNum = seqGenerator->getSeqNumber(WORLD_PEER);
         UGoPickup toWorldPickupReq = DataGenerator::getInstance()->genUGoPickup(truckid, warehouseid, seqNum);
         truckPool->setWarehouseid(truckid, warehouseid);
         UCommands toWorldPickupReqCommand;
@@ -179,65 +232,43 @@ void UPS::handlePickupReq(const AtoUPickupRequest fromAmazonPickUpReq)
         std::cout << "ready to send message to world at handlePickupReq\n============================================================" << std::endl;
         std::cout << toWorldPickupReqCommand.DebugString() << std::endl;
 
-        worldSocket->sendMsg(toWorldPickupReqCommand);
         seqGenerator->addSentMessage(seqNum, toWorldPickupReq);
+        worldWriter->post(toWorldPickupReqCommand);
 
-        // log into database
-        int packageCnt = fromAmazonPickUpReq.shipment_size();
-        for(int idx1 = 0; idx1 < packageCnt; ++idx1)
+        for(const ShipInfo & shipment : fromAmazonPickUpReq.shipment())
         {
-            ShipInfo shipment = fromAmazonPickUpReq.shipment(idx1);
-            int shipid = shipment.shipid();
-            int dest_x = shipment.destination_x();
-            int dest_y = shipment.destination_y();
-
-            if(shipment.has_upsaccount())
-            {
-                std::string upsaccount = shipment.upsaccount();
-                dbConn->createPkg(shipid, dest_x, dest_y, upsaccount);
-            }
-            else
-            {
-                dbConn->createPkg(shipid, dest_x, dest_y);
-            }
-            dbConn->updatePkgState(shipid, TRUCK_EN_ROUTE);
-            truckPool->addPackage(truckid, shipid);
-
-            int productCnt = shipment.products_size();
-            for(int idx2 = 0; idx2 < productCnt; ++idx2)
-            {
-                Product product = shipment.products(idx2);
-                std::string description = product.description();
-                int count = product.count();
-                dbConn->createProduct(shipid, description, count);
-            }
+            truckPool->addPackage(truckid, shipment.shipid());
         }
 
         Logger::getInstance()->log("world.log", "Send to world on pick up:\n", toWorldPickupReqCommand.DebugString());
+
+        // log into database, every package and product of the pickup in one transaction, written behind,
+        // the pickup request is completed once it's committed
+        dbWriter->createPickup(fromAmazonPickUpReq,
+                               std::bind(&UPS::completeRequest, this, AMAZON_PEER, fromAmazonPickUpReq.seqnum()),
+                               std::bind(&UPS::releaseRequest, this, AMAZON_PEER, fromAmazonPickUpReq.seqnum()));
+        return;
     }
     catch(std::exception & e)
     {
-        Logger::getInstance()->log("error.log", "handlePickupReq() error");
+        Logger::getInstance()->log("error.log", "dispatchTruckToPickup() error");
     }
+    completeRequest(AMAZON_PEER, fromAmazonPickUpReq.seqnum());
 }
 
 // receive from Amazon load has completed, ask world to deliver
 void UPS::handleDeliveryReq(const AtoULoadFinishRequest fromAmazonDeliverReq)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = fromAmazonDeliverReq.seqnum();
+    if(!claimRequest(AMAZON_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
         Logger::getInstance()->log("amazon.log", "Received from Amazon on load finish:\n", fromAmazonDeliverReq.DebugString());
 
-        // check received sequence number, or send ack message to Amazon
-        int recv_seq = fromAmazonDeliverReq.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
-        {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToAmazon(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
-
         // (1) generate UDeliveryLocation
         // (2) generate UGoDeliver
         // (3) add simulation speed to UCommands
@@ -247,7 +278,7 @@ void UPS::handleDeliveryReq(const AtoULoadFinishRequest fromAmazonDeliverReq)
         // (7) record sent message
         // (8) record handled message
         int truckid = fromAmazonDeliverReq.truckid();
-        int seqNum = seqGenerator->getSeqNumber();
+        int seqNum = seqGenerator->getSeqNumber(WORLD_PEER);
         std::vector<int> package_ids;
         int N = fromAmazonDeliverReq.shipid_size();
         for(int idx = 0; idx < N; ++idx)
@@ -255,6 +286,7 @@ void UPS::handleDeliveryReq(const AtoULoadFinishRequest fromAmazonDeliverReq)
             package_ids.push_back(fromAmazonDeliverReq.shipid(idx));
         }
         std::vector<UDeliveryLocation> packages;
+        dbWriter->waitCreated(package_ids); // the packages may still be queued for creation
         for(int packageid : package_ids)
         {
            packages.push_back(dbConn->getPackage(packageid));
@@ -268,62 +300,60 @@ void UPS::handleDeliveryReq(const AtoULoadFinishRequest fromAmazonDeliverReq)
         std::cout << "ready to send message to world at handleDeliveryReq\n============================================================" << std::endl;
         std::cout << toWorldDeliverReqCommand.DebugString() << std::endl;
         
-        worldSocket->sendMsg(toWorldDeliverReqCommand);
         seqGenerator->addSentMessage(seqNum, toWorldDeliverReq);
+        worldWriter->post(toWorldDeliverReqCommand);
 
-        // update database
-        for(int idx = 0; idx < fromAmazonDeliverReq.shipid_size(); ++idx)
-        {
-            int shipid = fromAmazonDeliverReq.shipid(idx);
-            dbConn->updatePkgState(shipid, OUT_FOR_DELIVERY);
-        }
-        
         Logger::getInstance()->log("world.log", "Send to world on delivery:\n", toWorldDeliverReqCommand.DebugString());
+
+        // update database, every package of the truck in one statement, the request is completed once it's committed
+        dbWriter->updatePkgStates(package_ids, OUT_FOR_DELIVERY,
+                                  std::bind(&UPS::completeRequest, this, AMAZON_PEER, recv_seq),
+                                  std::bind(&UPS::releaseRequest, this, AMAZON_PEER, recv_seq));
+        return;
     }
     catch(std::exception & e)
     {
         Logger::getInstance()->log("error.txt", "handleDeliveryReq() error");
     }   
+    completeRequest(AMAZON_PEER, recv_seq);
 }
 
 void UPS::handleAmazonErrMsg(const ErrorMessage errMsg)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = errMsg.seqnum();
+    if(!claimRequest(AMAZON_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
-        int recv_seq = errMsg.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
-        {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToAmazon(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
         Logger::getInstance()->log("error.log", "Amazon error message:\n", errMsg.DebugString());
     }
     catch(std::exception & e)
     {
         Logger::getInstance()->log("error.txt", "handleAmazonErrMsg() error");
     }
+    completeRequest(AMAZON_PEER, recv_seq);
 }
 
 void UPS::handleWorldErrMsg(const UErr errMsg)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = errMsg.seqnum();
+    if(!claimRequest(WORLD_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
-        int recv_seq = errMsg.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
-        {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToWorld(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
         Logger::getInstance()->log("error.log", "World error message:\n", errMsg.DebugString());
     }
     catch(std::exception & e)
     {
         Logger::getInstance()->log("error.txt", "handleWorldErrMsg() error");
     }
+    completeRequest(WORLD_PEER, recv_seq);
 }
 
 // there're two possiblities for receiving UFinished
@@ -331,20 +361,16 @@ void UPS::handleWorldErrMsg(const UErr errMsg)
 // (2) world notify the truck finished all shipments, return truck to truck pool
 void UPS::handleLoadReq(const UFinished fromWorldToLoadReq)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = fromWorldToLoadReq.seqnum();
+    if(!claimRequest(WORLD_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
         Logger::getInstance()->log("world.log", "Received from world arrive warehouse:\n", fromWorldToLoadReq.DebugString());
 
-        // check received sequence number, or send ack message to world
-        int recv_seq = fromWorldToLoadReq.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
-        {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToWorld(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
-
         // decide whether UFinished is used for
         // if used for notification of all deliveries for the truck, return the truck
         int truckid = fromWorldToLoadReq.truckid();
@@ -354,6 +380,7 @@ void UPS::handleLoadReq(const UFinished fromWorldToLoadReq)
             truckPool->returnTruck(truckid);
             std::cout << "Truck " << truckid << " has made all its deliveries" << std::endl;
             Logger::getInstance()->log("world.log", "Truck ", truckid, " has made all its deliveries");
+            completeRequest(WORLD_PEER, recv_seq);
             return;
         }
 
@@ -368,26 +395,27 @@ void UPS::handleLoadReq(const UFinished fromWorldToLoadReq)
         // (8) record sent message
         truckPool->registerTruck(truckid);
         int warehouseid = truckPool->getWarehouseid(truckid);
-        int seqNum = seqGenerator->getSeqNumber();
+        int seqNum = seqGenerator->getSeqNumber(AMAZON_PEER);
         const std::vector<int> packages = truckPool->getPackages(truckid);
         UtoALoadRequest toAmazonLoadReq = DataGenerator::getInstance()->genUtoALoadRequest(truckid, warehouseid, packages, seqNum);
         UtoACommand toAmazonLoadReqCommand;
         DataGenerator::getInstance()->addUtoALoadRequest(toAmazonLoadReqCommand, toAmazonLoadReq);
-        amazonSocket->sendMsg(toAmazonLoadReqCommand);
         seqGenerator->addSentMessage(seqNum, toAmazonLoadReq);
+        amazonWriter->post(toAmazonLoadReqCommand);
 
-        // update database
-        for(int packageid : packages)
-        {
-            dbConn->updatePkgState(packageid, TRUCK_WAITING);
-        }
-        
         Logger::getInstance()->log("amazon.log", "Send to Amazon on load:\n", toAmazonLoadReqCommand.DebugString());
+
+        // update database, every package of the truck in one statement, the request is completed once it's committed
+        dbWriter->updatePkgStates(packages, TRUCK_WAITING,
+                                  std::bind(&UPS::completeRequest, this, WORLD_PEER, recv_seq),
+                                  std::bind(&UPS::releaseRequest, this, WORLD_PEER, recv_seq));
+        return;
     }
     catch(std::exception & e)
     {
         Logger::getInstance()->log("error.txt", "handleLoadReq() error");
     }
+    completeRequest(WORLD_PEER, recv_seq);
 }
 
 // world delivery made, notify Amazon success
@@ -396,19 +424,15 @@ void UPS::handleLoadReq(const UFinished fromWorldToLoadReq)
 // UFinished is sent when all the deliveries are made for a truck
 void UPS::handleDeliveryMadeRes(const UDeliveryMade fromWorldDeliveryMade)
 {
+    // check received sequence number, the request is ack-ed once it's handled
+    int recv_seq = fromWorldDeliveryMade.seqnum();
+    if(!claimRequest(WORLD_PEER, recv_seq))
+    {
+        return;
+    }
     try
     {
         Logger::getInstance()->log("world.log", "Received from world delivery complete:\n", fromWorldDeliveryMade.DebugString());
-    
-        // check received sequence number, or send ack message to world
-        int recv_seq = fromWorldDeliveryMade.seqnum();
-        if(seqGenerator->checkAlreadyHandled(recv_seq))
-        {
-            std::cout << "Sequence number " << recv_seq << " already handled" << std::endl;
-            return;
-        }
-        sendAckMessageToWorld(recv_seq);
-        seqGenerator->addHandledRequest(recv_seq);
 
         // (1) generate Delivery
         // (2) add Delivery to UtoACommand
@@ -418,25 +442,35 @@ void UPS::handleDeliveryMadeRes(const UDeliveryMade fromWorldDeliveryMade)
         // (6) record handled message
         // (7) record sent message
         int packageid = fromWorldDeliveryMade.packageid();
-        int seqnum = seqGenerator->getSeqNumber();
-        dbConn->updatePkgState(packageid, DELIVERED);  
+        int seqnum = seqGenerator->getSeqNumber(AMAZON_PEER);
         Delivery toAmazonDelivery = DataGenerator::getInstance()->genDelivery(packageid, seqnum);
         UtoACommand toAmazonDeliveryCommand;
         DataGenerator::getInstance()->addDelivery(toAmazonDeliveryCommand, toAmazonDelivery);
-        amazonSocket->sendMsg(toAmazonDeliveryCommand);
         seqGenerator->addSentMessage(seqnum, toAmazonDelivery);
+        amazonWriter->post(toAmazonDeliveryCommand);
 
         Logger::getInstance()->log("amazon.log", "Send to Amazon on delivery:\n", toAmazonDeliveryCommand.DebugString());
+
+        // update database, the request is completed once it's committed
+        dbWriter->updatePkgState(packageid, DELIVERED,
+                                 std::bind(&UPS::completeRequest, this, WORLD_PEER, recv_seq),
+                                 std::bind(&UPS::releaseRequest, this, WORLD_PEER, recv_seq));
+        return;
     }
     catch(std::exception & e)
     {
         Logger::getInstance()->log("error.txt", "handleDeliveryMadeRes() error");
     }
+    completeRequest(WORLD_PEER, recv_seq);
 }
 
-void UPS::handleAck(int ack)
+void UPS::handleAcks(int peer, const google::protobuf::RepeatedField<google::protobuf::int64> & acks)
 {
-    Logger::getInstance()->log("amazon.log", "Receive ack:", ack);
-    Logger::getInstance()->log("world.log", "Receive ack:", ack);
-    seqGenerator->receiveAck(ack);
+    std::string ackList;
+    for(google::protobuf::int64 ack : acks)
+    {
+        ackList += " " + std::to_string(ack);
+    }
+    Logger::getInstance()->log(peer == WORLD_PEER ? "world.log" : "amazon.log", "Receive ack:", ackList);
+    seqGenerator->receiveAcks(peer, acks);
 }
\ No newline at end of file
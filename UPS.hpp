@@ -8,36 +8,52 @@
 #include "package.hpp"
 #include "constants.hpp"
 #include "truckpool.hpp"
+#include "threadpool.hpp"
+#include "keyedExecutor.hpp"
+#include "reactor.hpp"
+#include "coalescingWriter.hpp"
 #include "dataGenerator.hpp"
 #include "databaseLogger.hpp"
+#include "writeBehindQueue.hpp"
 #include "sequenceGenerator.hpp"
+#include "writeAheadLog.hpp"
 #include <string>
 #include <vector>
 #include <chrono>
 #include <thread>
 #include <atomic>
 #include <cstdlib>
+#include <utility>
 #include <exception>
-#define SLEEP_PERIOD 30
+#include <functional>
+#define RETRANSMIT_TICK_MS 10
 #define MAX_ERR_COUNT 20
+#define WAL_COMPACT_CHECK_MS 1000
 
 class UPS
 {
 private:
     void queryTruck(int truckid);
     void handleTruckStatusQuery(const UTruck truckStatusQueryRes);
+    bool claimRequest(int peer, int64_t seqNum);
+    void completeRequest(int peer, int64_t seqNum);
+    void releaseRequest(int peer, int64_t seqNum);
+    void sendAckMessage(int peer, unsigned seqNum);
     void sendAckMessageToAmazon(unsigned seqNum);
     void sendAckMessageToWorld(unsigned seqNum);
     void handleAmazonErrMsg(const ErrorMessage errMsg);
     void handleWorldErrMsg(const UErr errMsg);
-    void handleAck(int ack);
+    void handleAcks(int peer, const google::protobuf::RepeatedField<google::protobuf::int64> & acks);
 
     // receive user validation request from Amazon
     void handleUserValidationReq(const UserValidationRequest fromAmazonUserValidationReq);
 
-    // receive from Amazon to pick up, ask world to pick up
+    // receive from Amazon to pick up, assign a truck to the warehouse
     void handlePickupReq(const AtoUPickupRequest fromAmazonPickUpReq);
 
+    // run on the lane of the assigned truck, ask world to pick up
+    void dispatchTruckToPickup(int truckid, const AtoUPickupRequest fromAmazonPickUpReq);
+
     // receive from Amazon load has completed, ask world to deliver
     void handleDeliveryReq(const AtoULoadFinishRequest fromAmazonDeliverReq);
 
@@ -52,144 +68,125 @@ private:
     // UFinished is sent when all the deliveries are made for a truck
     void handleDeliveryMadeRes(const UDeliveryMade fromWorldDeliveryMade);
 
-    void handleAmazonRes()
+    // peer closed the connection or the stream is broken, nothing can be recovered
+    void handleConnectionClosed(const std::string peer)
+    {
+        Logger::getInstance()->log("error.log", "Connection to ", peer, " closed, program exits");
+        exit(EXIT_FAILURE);
+    }
+
+    // called on the reactor thread for every frame from Amazon, only dispatch here
+    void handleAmazonRes(const std::string & frame)
     {
-        while(true)
+        AtoUCommand amazonCommand;
+        if(!amazonCommand.ParseFromString(frame))
         {
-            AtoUCommand amazonCommand;
-            bool recvSuc = amazonSocket->recvMsg(amazonCommand);
-            if(!recvSuc)
+            Logger::getInstance()->log("error.log", "Receive from Amazon error");
+            if(++errCount >= MAX_ERR_COUNT)
             {
-                Logger::getInstance()->log("error.log", "Receive from Amazon error");
-                if(++errCount >= MAX_ERR_COUNT)
-                {
-                    Logger::getInstance()->log("error.log", "Reach max error count, program exits");
-                    exit(EXIT_FAILURE);
-                }
-                continue;
+                Logger::getInstance()->log("error.log", "Reach max error count, program exits");
+                exit(EXIT_FAILURE);
             }
+            return;
+        }
 
-            int userValidationReqCnt = amazonCommand.usrvlid_size();
-            int pickupReqCnt = amazonCommand.pikreq_size();
-            int loadReqCnt = amazonCommand.loadreq_size();
-            int errMsgCnt = amazonCommand.errmsg_size();
-            int ackCnt = amazonCommand.ack_size();
+        int userValidationReqCnt = amazonCommand.usrvlid_size();
+        int pickupReqCnt = amazonCommand.pikreq_size();
+        int loadReqCnt = amazonCommand.loadreq_size();
+        int errMsgCnt = amazonCommand.errmsg_size();
+        int ackCnt = amazonCommand.ack_size();
 
-            for(int idx = 0; idx < userValidationReqCnt; ++idx)
-            {
-                const UserValidationRequest & userValidationReq = amazonCommand.usrvlid(idx);
-                std::thread thd(&UPS::handleUserValidationReq, this, userValidationReq);
-                thd.detach();
-            }
+        for(int idx = 0; idx < userValidationReqCnt; ++idx)
+        {
+            const UserValidationRequest & userValidationReq = amazonCommand.usrvlid(idx);
+            threadPool->submit(std::bind(&UPS::handleUserValidationReq, this, userValidationReq));
+        }
 
-            for(int idx = 0; idx < pickupReqCnt; ++idx)
-            {
-                const AtoUPickupRequest & pickupReq = amazonCommand.pikreq(idx);
-                std::thread thd(&UPS::handlePickupReq, this, pickupReq);
-                thd.detach();
-            }
+        for(int idx = 0; idx < pickupReqCnt; ++idx)
+        {
+            const AtoUPickupRequest & pickupReq = amazonCommand.pikreq(idx);
+            threadPool->submit(std::bind(&UPS::handlePickupReq, this, pickupReq));
+        }
 
-            for(int idx = 0; idx < loadReqCnt; ++idx)
-            {
-                const AtoULoadFinishRequest & deliveryReq = amazonCommand.loadreq(idx);
-                std::thread thd(&UPS::handleDeliveryReq, this, deliveryReq);
-                thd.detach();
-            }
+        for(int idx = 0; idx < loadReqCnt; ++idx)
+        {
+            const AtoULoadFinishRequest & deliveryReq = amazonCommand.loadreq(idx);
+            truckLanes->submit(deliveryReq.truckid(), std::bind(&UPS::handleDeliveryReq, this, deliveryReq));
+        }
 
-            for(int idx = 0; idx < errMsgCnt; ++idx)
-            {
-                const ErrorMessage & errMsg = amazonCommand.errmsg(idx);
-                std::thread thd(&UPS::handleAmazonErrMsg, this, errMsg);
-                thd.detach();
-            }
+        for(int idx = 0; idx < errMsgCnt; ++idx)
+        {
+            const ErrorMessage & errMsg = amazonCommand.errmsg(idx);
+            threadPool->submit(std::bind(&UPS::handleAmazonErrMsg, this, errMsg));
+        }
 
-            for(int idx = 0; idx < ackCnt; ++idx)
-            {
-                int ack = amazonCommand.ack(idx);
-                std::thread thd(&UPS::handleAck, this, ack);
-                thd.detach();
-            }
+        if(ackCnt > 0) // all acks of the frame at once
+        {
+            threadPool->submit(std::bind(&UPS::handleAcks, this, AMAZON_PEER, std::move(*amazonCommand.mutable_ack())));
         }
     }
 
-    void handleWorldRes()
+    // called on the reactor thread for every frame from world, only dispatch here
+    void handleWorldRes(const std::string & frame)
     {
-        while(true)
+        UResponses worldRes;
+        if(!worldRes.ParseFromString(frame))
         {
-            UResponses worldRes;
-            bool recvSuc = worldSocket->recvMsg(worldRes);
-            if(!recvSuc)
+            Logger::getInstance()->log("error.log", "Receive from world error");
+            if(++errCount >= MAX_ERR_COUNT)
             {
-                Logger::getInstance()->log("error.log", "Receive from world error");
-                if(++errCount >= MAX_ERR_COUNT)
-                {
-                    Logger::getInstance()->log("error.log", "Reach max error count, program exits");
-                    exit(EXIT_FAILURE);
-                }
-                continue;
+                Logger::getInstance()->log("error.log", "Reach max error count, program exits");
+                exit(EXIT_FAILURE);
             }
+            return;
+        }
 
-            int pickupResCnt = worldRes.completions_size();
-            int deliveryMadeCnt = worldRes.delivered_size();
-            int ackCnt = worldRes.acks_size();
-            int errMsgCnt = worldRes.error_size();
-            int truckStatusCnt = worldRes.truckstatus_size();
+        int pickupResCnt = worldRes.completions_size();
+        int deliveryMadeCnt = worldRes.delivered_size();
+        int ackCnt = worldRes.acks_size();
+        int errMsgCnt = worldRes.error_size();
+        int truckStatusCnt = worldRes.truckstatus_size();
 
-            for(int idx = 0; idx < pickupResCnt; ++idx)
-            {
-                const UFinished & loadReq = worldRes.completions(idx);
-                std::thread thd(&UPS::handleLoadReq, this, loadReq);
-                thd.detach();
-            }
+        for(int idx = 0; idx < pickupResCnt; ++idx)
+        {
+            const UFinished & loadReq = worldRes.completions(idx);
+            truckLanes->submit(loadReq.truckid(), std::bind(&UPS::handleLoadReq, this, loadReq));
+        }
 
-            for(int idx = 0; idx < deliveryMadeCnt; ++idx)
-            {
-                const UDeliveryMade & deliveryMade = worldRes.delivered(idx);
-                std::thread thd(&UPS::handleDeliveryMadeRes, this, deliveryMade);
-                thd.detach(); 
-            }
+        for(int idx = 0; idx < deliveryMadeCnt; ++idx)
+        {
+            const UDeliveryMade & deliveryMade = worldRes.delivered(idx);
+            truckLanes->submit(deliveryMade.truckid(), std::bind(&UPS::handleDeliveryMadeRes, this, deliveryMade));
+        }
 
-            for(int idx = 0; idx < ackCnt; ++idx)
-            {
-                int ack = worldRes.acks(idx);
-                std::thread thd(&UPS::handleAck, this, ack);
-                thd.detach();
-            }
+        if(ackCnt > 0) // all acks of the frame at once
+        {
+            threadPool->submit(std::bind(&UPS::handleAcks, this, WORLD_PEER, std::move(*worldRes.mutable_acks())));
+        }
 
-            for(int idx = 0; idx < errMsgCnt; ++idx)
-            {
-                const UErr & errMsg = worldRes.error(idx);
-                std::thread thd(&UPS::handleWorldErrMsg, this, errMsg);
-                thd.detach(); 
-            }
+        for(int idx = 0; idx < errMsgCnt; ++idx)
+        {
+            const UErr & errMsg = worldRes.error(idx);
+            threadPool->submit(std::bind(&UPS::handleWorldErrMsg, this, errMsg));
+        }
 
-            for(int idx = 0; idx < truckStatusCnt; ++idx)
-            {
-                const UTruck truckStatus = worldRes.truckstatus(idx);
-                std::thread thd(&UPS::handleTruckStatusQuery, this, truckStatus);
-                thd.detach();
-            }
+        for(int idx = 0; idx < truckStatusCnt; ++idx)
+        {
+            const UTruck truckStatus = worldRes.truckstatus(idx);
+            truckLanes->submit(truckStatus.truckid(), std::bind(&UPS::handleTruckStatusQuery, this, truckStatus));
         }
     }
 
-public:
-    UPS() : 
-        errCount { 0 },
-        worldSocket { nullptr },
-        amazonSocket { nullptr },
-        truckPool { new TruckPool },
-        dbConn { new DatabaseLogger },
-        seqGenerator { new SequenceGenerator }
-        {}
-
-    int connectWorld(const char * hostname, const char * port)
+    // connect to world worldid, or create a new world if it's -1, on a new socket, true if world accepts
+    bool requestWorld(const char * hostname, const char * port, int64_t worldid, UConnected & connRes)
     {
         // send connect request to world
         bool sendWorldConnSuccuss = false;
+        delete(worldSocket); // a refused reconnection is closed by world
         worldSocket = new Socket(hostname, port);
         while(!sendWorldConnSuccuss)
         {
-            UConnect connectData = DataGenerator::getInstance()->genConnectWorldData(truckPool);
+            UConnect connectData = DataGenerator::getInstance()->genConnectWorldData(truckPool, worldid);
             sendWorldConnSuccuss = worldSocket->sendMsg(connectData);
             Logger::getInstance()->log("world.log", "Connect world message:\n", connectData.DebugString());
         }
@@ -197,13 +194,45 @@ public:
 
         // receive connection response from world
         bool recvWorldConnSuccess = false;
-        UConnected connRes;
         while(!recvWorldConnSuccess)
         {
             recvWorldConnSuccess = worldSocket->recvMsg(connRes);
             Logger::getInstance()->log("world.log", connRes.worldid(), connRes.result());
         }
-        
+        return connRes.result() == "connected!";
+    }
+
+public:
+    UPS() : 
+        errCount { 0 },
+        worldSocket { nullptr },
+        amazonSocket { nullptr },
+        worldWriter { nullptr },
+        amazonWriter { nullptr },
+        truckPool { new TruckPool },
+        dbConn { new DatabaseLogger },
+        dbWriter { new WriteBehindQueue(dbConn) },
+        seqGenerator { new SequenceGenerator },
+        wal { new WriteAheadLog(WAL_PATH) },
+        threadPool { new ThreadPool(THREAD_POOL_SIZE) },
+        truckLanes { new KeyedExecutor },
+        reactor { new Reactor }
+    {
+        // un-acknowledged messages and handled sequence numbers of the last run
+        seqGenerator->recover(wal);
+    }
+
+    // reconnect to the world of the last run, so the recovered messages and sequence numbers of world stay valid,
+    // or create a new world if there's none or it's gone, which drops the recovered state of world
+    int connectWorld(const char * hostname, const char * port)
+    {
+        UConnected connRes;
+        int64_t lastWorldid = seqGenerator->getWorldId();
+        if(lastWorldid < 0 || !requestWorld(hostname, port, lastWorldid, connRes))
+        {
+            requestWorld(hostname, port, -1, connRes);
+        }
+        seqGenerator->setWorldId(connRes.worldid());
         Logger::getInstance()->log("world.log", "Connect world success");
         return connRes.worldid();
     }
@@ -216,7 +245,7 @@ public:
         unsigned connAmazonSeq = 0;
         while(!sendAmazonConnSuccess)
         {
-            connAmazonSeq = seqGenerator->getSeqNumber();
+            connAmazonSeq = seqGenerator->getSeqNumber(AMAZON_PEER);
             UtoAConnect connectData = DataGenerator::getInstance()->genUAConnectData(worldid, connAmazonSeq);
             UtoACommand connReq;
             DataGenerator::getInstance()->addUAConnectData(connReq, connectData);
@@ -249,32 +278,48 @@ public:
 
     void run()
     {
-        // create two detached threads to handle communication with Amazon and world
-        std::thread amazonThread(&UPS::handleAmazonRes, this);
-        amazonThread.detach();
-        std::thread worldThread(&UPS::handleWorldRes, this);
-        worldThread.detach();
+        // everything sent by the handlers within one window goes out as one UCommands/UtoACommand
+        worldWriter = new CoalescingWriter<UCommands>(worldSocket);
+        amazonWriter = new CoalescingWriter<UtoACommand>(amazonSocket);
+        reactor->addTimer(FLUSH_WINDOW_MS, std::bind(&CoalescingWriter<UCommands>::flush, worldWriter));
+        reactor->addTimer(FLUSH_WINDOW_MS, std::bind(&CoalescingWriter<UtoACommand>::flush, amazonWriter));
+
+        // hand both sockets over to one reactor thread, which receives and sends for Amazon and world
+        using std::placeholders::_1;
+        reactor->addSocket(amazonSocket, std::bind(&UPS::handleAmazonRes, this, _1), std::bind(&UPS::handleConnectionClosed, this, "Amazon"));
+        reactor->addSocket(worldSocket, std::bind(&UPS::handleWorldRes, this, _1), std::bind(&UPS::handleConnectionClosed, this, "world"));
+
+        // resend un-acknowledged message as soon as its retransmission timer expires
+        reactor->addTimer(RETRANSMIT_TICK_MS, std::bind(&SequenceGenerator::resendMessage, seqGenerator, worldSocket, amazonSocket));
+
+        // keep the write-ahead log short, compaction runs on the thread pool
+        reactor->addTimer(WAL_COMPACT_CHECK_MS, [this]()
+        {
+            threadPool->submit(std::bind(&SequenceGenerator::compactLog, seqGenerator));
+        });
 
-        while(true)
+        /* DEBUG
+        // query truck status to check if the world is running
+        int truckCount = truckPool->getTruckCount();
+        for(int idx = 0; idx < truckCount; ++idx)
         {
-            // main thread is responsible for resend un-acknowledged message, and clear handled sequence number
-            std::this_thread::sleep_for(std::chrono::seconds(SLEEP_PERIOD)); 
-            seqGenerator->clearHandledRequest();
-            seqGenerator->resendMessage(worldSocket, amazonSocket);
-
-            /* DEBUG
-            // query truck status to check if the world is running
-            int truckCount = truckPool->getTruckCount();
-            for(int idx = 0; idx < truckCount; ++idx)
-            {
-                queryTruck(idx);
-            }
-            */
+            queryTruck(idx);
         }
+        */
+
+        // main thread runs the reactor from now on
+        reactor->run();
     }
 
     ~UPS() noexcept
     {
+        delete(threadPool);
+        delete(truckLanes);
+        delete(reactor);
+        delete(dbWriter); // drains queued events into dbConn
+        delete(wal); // syncs the queued records, their callbacks still ack through the writers
+        delete(worldWriter);
+        delete(amazonWriter);
         delete(worldSocket);
         delete(amazonSocket);
         delete(truckPool);
@@ -286,9 +331,16 @@ private:
     std::atomic<unsigned> errCount;
     Socket * worldSocket;
     Socket * amazonSocket;
+    CoalescingWriter<UCommands> * worldWriter; // all handler traffic to world goes through it
+    CoalescingWriter<UtoACommand> * amazonWriter; // all handler traffic to Amazon goes through it
     TruckPool * truckPool;
     DatabaseLogger * dbConn;
+    WriteBehindQueue * dbWriter; // package events are written behind, handlers never wait on a commit
     SequenceGenerator * seqGenerator;
+    WriteAheadLog * wal; // protocol state of seqGenerator, replayed on restart
+    ThreadPool * threadPool; // executor for received request/response not bound to a truck
+    KeyedExecutor * truckLanes; // executor keyed by truck id, events of one truck are handled in order
+    Reactor * reactor; // event loop owning Amazon and world sockets after connection
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "UA.pb.h"
+#include "world_ups.pb.h"
+#include "truckpool.hpp"
+#include "dataGenerator.hpp"
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+// one UCommands of range(0) pickups, generated, added and serialized as a handler sends them
+static void BM_GenPickupCommand(benchmark::State & state)
+{
+    DataGenerator * dataGenerator = DataGenerator::getInstance();
+    std::string serialized;
+    for(auto _ : state)
+    {
+        UCommands command;
+        for(int idx = 0; idx < state.range(0); ++idx)
+        {
+            dataGenerator->addUGoPickup(command, dataGenerator->genUGoPickup(idx, idx, idx));
+        }
+        command.SerializeToString(&serialized);
+        benchmark::DoNotOptimize(serialized.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// one UGoDeliver of range(0) packages, every package copied into the message twice(generate and add)
+static void BM_GenDeliverCommand(benchmark::State & state)
+{
+    DataGenerator * dataGenerator = DataGenerator::getInstance();
+    std::vector<UDeliveryLocation> packages(state.range(0));
+    for(int idx = 0; idx < state.range(0); ++idx)
+    {
+        packages[idx].set_packageid(idx);
+        packages[idx].set_x(idx);
+        packages[idx].set_y(idx);
+    }
+    std::string serialized;
+    for(auto _ : state)
+    {
+        UCommands command;
+        dataGenerator->addUGoDeliver(command, dataGenerator->genUGoDeliver(1, packages, 1));
+        command.SerializeToString(&serialized);
+        benchmark::DoNotOptimize(serialized.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// one UtoACommand of range(0) load requests with 8 packages each
+static void BM_GenLoadCommand(benchmark::State & state)
+{
+    DataGenerator * dataGenerator = DataGenerator::getInstance();
+    std::vector<int> packages { 1, 2, 3, 4, 5, 6, 7, 8 };
+    std::string serialized;
+    for(auto _ : state)
+    {
+        UtoACommand command;
+        for(int idx = 0; idx < state.range(0); ++idx)
+        {
+            dataGenerator->addUtoALoadRequest(command, dataGenerator->genUtoALoadRequest(idx, idx, packages, idx));
+        }
+        command.SerializeToString(&serialized);
+        benchmark::DoNotOptimize(serialized.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// the UConnect of every truck in the pool, sent once on startup
+static void BM_GenConnectWorldData(benchmark::State & state)
+{
+    DataGenerator * dataGenerator = DataGenerator::getInstance();
+    TruckPool truckPool;
+    for(auto _ : state)
+    {
+        benchmark::DoNotOptimize(dataGenerator->genConnectWorldData(&truckPool).ByteSizeLong());
+    }
+    state.SetItemsProcessed(state.iterations() * truckPool.getTruckCount());
+}
+
+// a resend command of range(0) stored pickups, spliced from their bytes as SequenceGenerator::resendMessage() does
+static void BM_AppendEncodedField(benchmark::State & state)
+{
+    DataGenerator * dataGenerator = DataGenerator::getInstance();
+    std::string encoded = dataGenerator->genUGoPickup(1, 1, 1).SerializeAsString();
+    std::string command;
+    for(auto _ : state)
+    {
+        command.clear();
+        for(int idx = 0; idx < state.range(0); ++idx)
+        {
+            dataGenerator->appendEncodedField(command, UCommands::kPickupsFieldNumber, encoded);
+        }
+        benchmark::DoNotOptimize(command.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_GenPickupCommand)->RangeMultiplier(8)->Range(1, 4096);
+BENCHMARK(BM_GenDeliverCommand)->RangeMultiplier(8)->Range(1, 4096);
+BENCHMARK(BM_GenLoadCommand)->RangeMultiplier(8)->Range(1, 4096);
+BENCHMARK(BM_GenConnectWorldData);
+BENCHMARK(BM_AppendEncodedField)->RangeMultiplier(8)->Range(1, 4096);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,44 @@
+#include "threadsafe_unordered_map.hpp"
+#include "sharded_unordered_map.hpp"
+#include <benchmark/benchmark.h>
+#define BENCH_MAP_KEYS 65536
+
+// shared map hit by 1 to 64 threads, range(0) percent of operations are inserts and the rest lookups
+template<typename Map>
+static void BM_MapMixed(benchmark::State & state)
+{
+    static Map * map = nullptr;
+    if(state.thread_index() == 0)
+    {
+        map = new Map;
+        for(unsigned key = 0; key < BENCH_MAP_KEYS; key += 2)
+        {
+            map->insert(key, key);
+        }
+    }
+    unsigned writePercent = state.range(0);
+    unsigned rand = state.thread_index() * 7919 + 1;
+    for(auto _ : state)
+    {
+        rand = rand * 1103515245 + 12345;
+        unsigned key = (rand >> 8) % BENCH_MAP_KEYS;
+        if(rand % 100 < writePercent)
+        {
+            map->insert(key, key);
+        }
+        else
+        {
+            benchmark::DoNotOptimize(map->find(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if(state.thread_index() == 0)
+    {
+        delete(map);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_MapMixed, ThreadsafeUnorderedMap<unsigned, unsigned>)->Arg(10)->Arg(50)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MapMixed, ShardedUnorderedMap<unsigned, unsigned>)->Arg(10)->Arg(50)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN();
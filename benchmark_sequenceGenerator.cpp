@@ -0,0 +1,97 @@
+#include "UA.pb.h"
+#include "world_ups.pb.h"
+#include "constants.hpp"
+#include "dataGenerator.hpp"
+#include "sequenceGenerator.hpp"
+#include <benchmark/benchmark.h>
+#define BENCH_HANDLED_NUM 4096
+
+// one SequenceGenerator shared by 1 to 16 threads, as the handlers of the thread pool share it,
+// no write-ahead log is attached, so nothing is written to disk
+static SequenceGenerator * seqGenerator = nullptr;
+
+static void setupGenerator(const benchmark::State & state)
+{
+    if(state.thread_index() == 0)
+    {
+        seqGenerator = new SequenceGenerator;
+    }
+}
+
+static void teardownGenerator(const benchmark::State & state)
+{
+    if(state.thread_index() == 0)
+    {
+        delete(seqGenerator);
+        seqGenerator = nullptr;
+    }
+}
+
+static void BM_GetSeqNumber(benchmark::State & state)
+{
+    setupGenerator(state);
+    for(auto _ : state)
+    {
+        benchmark::DoNotOptimize(seqGenerator->getSeqNumber(WORLD_PEER));
+    }
+    state.SetItemsProcessed(state.iterations());
+    teardownGenerator(state);
+}
+
+// full life of a sent message: number it, register it(serialize and arm its timer), and take its ack
+static void BM_SendAndAck(benchmark::State & state)
+{
+    setupGenerator(state);
+    UGoPickup pickup = DataGenerator::getInstance()->genUGoPickup(1, 1, 0);
+    for(auto _ : state)
+    {
+        unsigned seqNum = seqGenerator->getSeqNumber(WORLD_PEER);
+        pickup.set_seqnum(seqNum);
+        seqGenerator->addSentMessage(seqNum, pickup);
+        seqGenerator->receiveAck(WORLD_PEER, seqNum);
+    }
+    state.SetItemsProcessed(state.iterations());
+    teardownGenerator(state);
+}
+
+// ack of a message ack-ed before, as a retransmitted ack from the peer
+static void BM_ReceiveDuplicateAck(benchmark::State & state)
+{
+    setupGenerator(state);
+    unsigned seqNum = state.thread_index();
+    for(auto _ : state)
+    {
+        seqGenerator->receiveAck(WORLD_PEER, seqNum);
+    }
+    state.SetItemsProcessed(state.iterations());
+    teardownGenerator(state);
+}
+
+// look up sequence numbers received from the peer, half of them handled before
+static void BM_CheckAlreadyHandled(benchmark::State & state)
+{
+    setupGenerator(state);
+    if(state.thread_index() == 0)
+    {
+        for(int64_t seqNum = 0; seqNum < BENCH_HANDLED_NUM; seqNum += 2)
+        {
+            seqGenerator->tryClaim(AMAZON_PEER, seqNum);
+            seqGenerator->completeClaim(AMAZON_PEER, seqNum, [](){});
+        }
+    }
+    int64_t seqNum = state.thread_index();
+    for(auto _ : state)
+    {
+        benchmark::DoNotOptimize(seqGenerator->checkAlreadyHandled(AMAZON_PEER, seqNum));
+        seqNum = (seqNum + 1) % BENCH_HANDLED_NUM;
+    }
+    state.SetItemsProcessed(state.iterations());
+    teardownGenerator(state);
+}
+
+BENCHMARK(BM_GetSeqNumber)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_SendAndAck)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_ReceiveDuplicateAck)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_CheckAlreadyHandled)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,79 @@
+#include "world_ups.pb.h"
+#include "socket.hpp"
+#include "dataGenerator.hpp"
+#include <thread>
+#include <sys/socket.h>
+#include <benchmark/benchmark.h>
+#define BENCH_SOCKET_FRAMES 64
+
+// one UCommands of range(0) pickups, about 10 bytes each, sent and received through the blocking path of a socketpair
+// the frame has to fit in the kernel buffer, since sender and receiver are the same thread
+static void BM_SocketSendRecv(benchmark::State & state)
+{
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+        state.SkipWithError("socketpair error");
+        return;
+    }
+    Socket sender(fds[0]);
+    Socket receiver(fds[1]);
+    UCommands command;
+    for(int idx = 0; idx < state.range(0); ++idx)
+    {
+        DataGenerator::getInstance()->addUGoPickup(command, DataGenerator::getInstance()->genUGoPickup(idx, idx, idx));
+    }
+    UCommands received;
+    for(auto _ : state)
+    {
+        if(!sender.sendMsg(command) || !receiver.recvMsg(received))
+        {
+            state.SkipWithError("send/recv error");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * command.ByteSizeLong());
+}
+
+// BENCH_SOCKET_FRAMES frames from one sender thread to one receiver thread on a socketpair, range(0) pickups per frame,
+// frames larger than the kernel buffer are written and read in pieces
+static void BM_SocketStream(benchmark::State & state)
+{
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+        state.SkipWithError("socketpair error");
+        return;
+    }
+    Socket sender(fds[0]);
+    Socket receiver(fds[1]);
+    UCommands command;
+    for(int idx = 0; idx < state.range(0); ++idx)
+    {
+        DataGenerator::getInstance()->addUGoPickup(command, DataGenerator::getInstance()->genUGoPickup(idx, idx, idx));
+    }
+    for(auto _ : state)
+    {
+        state.PauseTiming();
+        std::thread recvThread([&receiver]()
+        {
+            UCommands received;
+            for(int cnt = 0; cnt < BENCH_SOCKET_FRAMES; ++cnt)
+            {
+                receiver.recvMsg(received);
+            }
+        });
+        state.ResumeTiming();
+        for(int cnt = 0; cnt < BENCH_SOCKET_FRAMES; ++cnt)
+        {
+            sender.sendMsg(command);
+        }
+        recvThread.join();
+    }
+    state.SetBytesProcessed(state.iterations() * BENCH_SOCKET_FRAMES * command.ByteSizeLong());
+}
+
+BENCHMARK(BM_SocketSendRecv)->RangeMultiplier(8)->Range(1, 4096);
+BENCHMARK(BM_SocketStream)->RangeMultiplier(8)->Range(1, 32768)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,54 @@
+#include "truckpool.hpp"
+#include <benchmark/benchmark.h>
+
+// 1 to 16 threads, each playing one warehouse: take a truck, let it depart and return it,
+// as the pickup handler and the truck lane do for every pickup, there are always trucks free
+static void BM_TruckChurn(benchmark::State & state)
+{
+    static TruckPool * truckPool = nullptr;
+    if(state.thread_index() == 0)
+    {
+        truckPool = new TruckPool;
+    }
+    int warehouseid = state.thread_index();
+    for(auto _ : state)
+    {
+        int truckid = -1;
+        truckPool->requestTruck(warehouseid, [&truckid](int assigned) { truckid = assigned; });
+        truckPool->setWarehouseid(truckid, warehouseid);
+        truckPool->registerTruck(truckid);
+        truckPool->returnTruck(truckid);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if(state.thread_index() == 0)
+    {
+        delete(truckPool);
+    }
+}
+
+// pickups to a warehouse with a truck already on the way, served from the assignment without taking a truck
+static void BM_TruckAssigned(benchmark::State & state)
+{
+    static TruckPool * truckPool = nullptr;
+    if(state.thread_index() == 0)
+    {
+        truckPool = new TruckPool;
+    }
+    int warehouseid = state.thread_index();
+    for(auto _ : state)
+    {
+        int truckid = -1;
+        truckPool->requestTruck(warehouseid, [&truckid](int assigned) { truckid = assigned; });
+        benchmark::DoNotOptimize(truckid);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if(state.thread_index() == 0)
+    {
+        delete(truckPool);
+    }
+}
+
+BENCHMARK(BM_TruckChurn)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_TruckAssigned)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,103 @@
+#ifndef COALESCING_WRITER_HPP__
+#define COALESCING_WRITER_HPP__
+
+#include "socket.hpp"
+#include "dataGenerator.hpp"
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#define FLUSH_WINDOW_MS 5
+#define FLUSH_SIZE_BYTES 65536
+#define ACK_DELAY_MS 20
+
+// per-peer writer, every command posted within one flush window is merged into a single frame
+// Command is UCommands or UtoACommand, whose fields are all repeated (or the same optional simspeed),
+// so MergeFrom() simply appends acks, pickups, deliveries, load requests ...
+// flush() is driven by a reactor timer every FLUSH_WINDOW_MS, or right away once FLUSH_SIZE_BYTES is queued
+// acks are delayed like TCP delayed-ack: they ride on the next frame carrying a command,
+// and an ack-only frame is sent only if no command shows up within ACK_DELAY_MS
+// pending acks are sorted and deduplicated before each flush, a burst of completions is acked by one frame
+template<typename Command>
+class CoalescingWriter
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void flushLocked()
+    {
+        if(pendingCnt == 0 && pendingAcks.empty())
+        {
+            return;
+        }
+        // a peer retransmitting a run of requests gets the acks once each, in order
+        std::sort(pendingAcks.begin(), pendingAcks.end());
+        pendingAcks.erase(std::unique(pendingAcks.begin(), pendingAcks.end()), pendingAcks.end());
+        for(unsigned ack : pendingAcks)
+        {
+            DataGenerator::getInstance()->addSeqNumberToCommand(pending, ack);
+        }
+        socket->sendMsg(pending);
+        pending.Clear();
+        pendingAcks.clear();
+        pendingBytes = 0;
+        pendingCnt = 0;
+    }
+
+public:
+    explicit CoalescingWriter(Socket * _socket, size_t _maxBytes = FLUSH_SIZE_BYTES) :
+        socket { _socket },
+        maxBytes { _maxBytes },
+        pendingBytes { 0 },
+        pendingCnt { 0 }
+        {}
+
+    CoalescingWriter(const CoalescingWriter &) = delete;
+    CoalescingWriter & operator=(const CoalescingWriter &) = delete;
+
+    void post(const Command & command)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        pending.MergeFrom(command);
+        pendingBytes += command.ByteSizeLong();
+        ++pendingCnt;
+        if(pendingBytes >= maxBytes)
+        {
+            flushLocked();
+        }
+    }
+
+    // ack the received sequence number with the next outgoing frame
+    void postAck(unsigned seqNum)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        if(pendingAcks.empty())
+        {
+            firstAckTime = Clock::now();
+        }
+        pendingAcks.push_back(seqNum);
+    }
+
+    void flush()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        if(pendingCnt == 0 && !pendingAcks.empty() && Clock::now() - firstAckTime < std::chrono::milliseconds(ACK_DELAY_MS))
+        {
+            return; // only acks so far, hold them a little longer for a command to piggyback on
+        }
+        flushLocked();
+    }
+
+private:
+    std::mutex mtx;
+    Socket * socket;
+    const size_t maxBytes;
+    Command pending;
+    size_t pendingBytes;
+    unsigned pendingCnt; // commands merged into pending
+    std::vector<unsigned> pendingAcks;
+    Clock::time_point firstAckTime; // when the oldest pending ack was posted
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef CONNECTION_POOL_HPP__
+#define CONNECTION_POOL_HPP__
+
+#include "logger.hpp"
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <condition_variable>
+#include <pqxx/pqxx>
+#define DB_POOL_SIZE 8
+#define DB_CHECKOUT_TIMEOUT_MS 5000
+#define DB_HEALTH_CHECK_MS 30000
+
+// a fixed number of database connections shared by the handler threads, each connection is used by one thread at a time
+// a connection is pinged before it's handed out if it has been idle for DB_HEALTH_CHECK_MS or its last user failed,
+// and a connection found dead is re-opened, so a restart of postgres costs the failed statements only
+// onConnect is called on every connection opened, before it's handed out, like to prepare statements
+class ConnectionPool
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot
+    {
+        pqxx::connection * conn; // nullptr if it has to be re-opened
+        Clock::time_point lastUsed;
+        bool suspect; // its last user failed, maybe because the connection is broken
+    };
+
+    pqxx::connection * connect()
+    {
+        pqxx::connection * conn = new pqxx::connection(connInfo);
+        if(!conn->is_open())
+        {
+            delete(conn);
+            throw pqxx::broken_connection("database connection failure");
+        }
+        try
+        {
+            if(onConnect)
+            {
+                onConnect(*conn);
+            }
+        }
+        catch(...)
+        {
+            delete(conn);
+            throw;
+        }
+        return conn;
+    }
+
+    // true if the connection still answers
+    bool ping(pqxx::connection * conn)
+    {
+        try
+        {
+            pqxx::nontransaction N(*conn);
+            N.exec("SELECT 1;");
+            return true;
+        }
+        catch(std::exception & e)
+        {
+            Logger::getInstance()->log("error.log", "Database health check failure:", e.what());
+            return false;
+        }
+    }
+
+    // make the connection of slot usable, re-open it if it's closed or doesn't answer
+    // called without the lock, the slot is owned by the caller
+    void prepareSlot(Slot & slot)
+    {
+        if(slot.conn != nullptr && !slot.conn->is_open())
+        {
+            delete(slot.conn);
+            slot.conn = nullptr;
+        }
+        if(slot.conn != nullptr && (slot.suspect || Clock::now() - slot.lastUsed > std::chrono::milliseconds(DB_HEALTH_CHECK_MS)) && !ping(slot.conn))
+        {
+            delete(slot.conn);
+            slot.conn = nullptr;
+        }
+        if(slot.conn == nullptr)
+        {
+            slot.conn = connect();
+            Logger::getInstance()->log("test.log", "Database reconnection success");
+        }
+        slot.suspect = false;
+    }
+
+    // wait until a slot is idle, throw if none is within the timeout
+    Slot checkout()
+    {
+        Slot slot;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            if(!cv.wait_for(lck, std::chrono::milliseconds(checkoutTimeoutMs), [this](){ return !idle.empty(); }))
+            {
+                throw std::runtime_error("database connection checkout timeout");
+            }
+            slot = idle.back(); idle.pop_back();
+        }
+        try
+        {
+            prepareSlot(slot);
+        }
+        catch(...)
+        {
+            checkin(slot); // keep the pool size, the next user tries to re-open it
+            throw;
+        }
+        return slot;
+    }
+
+    void checkin(Slot slot)
+    {
+        slot.lastUsed = Clock::now();
+        std::unique_lock<std::mutex> lck(mtx);
+        idle.push_back(slot); // most recently used first, idle ones age out and get checked
+        cv.notify_one();
+    }
+
+public:
+    // a connection checked out of the pool, returned when it goes out of scope
+    // if it goes out of scope by an exception, the connection is checked before its next use
+    class Connection
+    {
+    public:
+        explicit Connection(ConnectionPool & _pool) :
+            pool(_pool),
+            slot(_pool.checkout())
+            {}
+
+        Connection(const Connection &) = delete;
+        Connection & operator=(const Connection &) = delete;
+
+        pqxx::connection & operator*() const { return *slot.conn; }
+
+        pqxx::connection * operator->() const { return slot.conn; }
+
+        ~Connection() noexcept
+        {
+            slot.suspect = std::uncaught_exception();
+            pool.checkin(slot);
+        }
+
+    private:
+        ConnectionPool & pool;
+        Slot slot;
+    };
+
+public:
+    ConnectionPool(const std::string & _connInfo, std::function<void(pqxx::connection &)> _onConnect,
+        size_t poolSize = DB_POOL_SIZE, unsigned _checkoutTimeoutMs = DB_CHECKOUT_TIMEOUT_MS) :
+        connInfo { _connInfo },
+        onConnect { _onConnect },
+        checkoutTimeoutMs { _checkoutTimeoutMs }
+    {
+        try
+        {
+            for(size_t idx = 0; idx < poolSize; ++idx)
+            {
+                idle.push_back(Slot { connect(), Clock::now(), false });
+            }
+        }
+        catch(std::exception & e)
+        {
+            Logger::getInstance()->log("test.log", "Database connection failure:", e.what());
+            exit(EXIT_FAILURE);
+        }
+        Logger::getInstance()->log("test.log", "Database connection success");
+    }
+
+    ConnectionPool(const ConnectionPool &) = delete;
+    ConnectionPool & operator=(const ConnectionPool &) = delete;
+
+    // every connection has to be checked in
+    ~ConnectionPool() noexcept
+    {
+        for(Slot & slot : idle)
+        {
+            if(slot.conn != nullptr && slot.conn->is_open())
+            {
+                slot.conn->disconnect();
+            }
+            delete(slot.conn);
+        }
+    }
+
+private:
+    const std::string connInfo;
+    const std::function<void(pqxx::connection &)> onConnect;
+    const unsigned checkoutTimeoutMs;
+    std::mutex mtx; // guards the idle slots
+    std::condition_variable cv;
+    std::vector<Slot> idle;
+};
+
+#endif
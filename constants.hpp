@@ -7,4 +7,9 @@ const int TRUCK_WAITING = 2;
 const int OUT_FOR_DELIVERY = 3;
 const int DELIVERED = 4;
 
+// peers UPS talks to, each with its own sequence numbers
+const int WORLD_PEER = 0;
+const int AMAZON_PEER = 1;
+const int PEER_NUM = 2;
+
 #endif
\ No newline at end of file
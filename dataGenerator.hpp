@@ -5,8 +5,12 @@
 #include "world_ups.pb.h"
 #include "truck.hpp"
 #include "truckpool.hpp"
+#include <string>
 #include <vector>
+#include <cstdint>
 #include <iostream>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #define SIMSPEED 100
 
 class DataGenerator
@@ -60,11 +64,40 @@ public:
         toWorldAckCommand.add_acks(seqNum);
     }
 
-    // generate UConnect data
-    UConnect genConnectWorldData(const TruckPool * tp)
+    // add sequence number to the command of either peer, used where the peer is a template parameter
+    void addSeqNumberToCommand(UtoACommand & toAmazonAckCommand, unsigned seqNum)
+    {
+        addSeqNumberToAmazonCommand(toAmazonAckCommand, seqNum);
+    }
+
+    void addSeqNumberToCommand(UCommands & toWorldAckCommand, unsigned seqNum)
+    {
+        addSeqNumberToWorldCommand(toWorldAckCommand, seqNum);
+    }
+
+    // append an already serialized message to a serialized command, as one more element of its repeated field fieldNumber
+    // same bytes as add_xxx() on the command then serializing it, without parsing or re-encoding the message
+    void appendEncodedField(std::string & command, int fieldNumber, const std::string & encoded)
+    {
+        using google::protobuf::internal::WireFormatLite;
+        uint8_t header[10]; // tag and length, 5 bytes of varint at most each
+        uint8_t * end = google::protobuf::io::CodedOutputStream::WriteTagToArray(WireFormatLite::MakeTag(fieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED), header);
+        end = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(encoded.size(), end);
+        command.append(reinterpret_cast<const char *>(header), end - header);
+        command.append(encoded);
+    }
+
+    // generate UConnect data, to create a new world with every truck of the pool,
+    // or to reconnect to world worldid(if not -1), whose trucks were created with it
+    UConnect genConnectWorldData(const TruckPool * tp, int64_t worldid = -1)
     {
         UConnect connReq;
         connReq.set_isamazon(false);
+        if(worldid >= 0)
+        {
+            connReq.set_worldid(worldid);
+            return connReq;
+        }
         int truckCnt = tp->getTruckCount();
         for(int idx = 0; idx < truckCnt; ++idx)
         {
@@ -104,7 +137,7 @@ public:
     }
 
     // add UserValidationResponse to UtoACommand
-    void addUserValidationResponse(UtoACommand & toAmazonUserValidationResCommand, UserValidationResponse & toAmazonUserValidationRes)
+    void addUserValidationResponse(UtoACommand & toAmazonUserValidationResCommand, const UserValidationResponse & toAmazonUserValidationRes)
     {
         UserValidationResponse * temp_toAmazonUserValidationRes = toAmazonUserValidationResCommand.add_usrvlid();
         *temp_toAmazonUserValidationRes = toAmazonUserValidationRes;
@@ -121,7 +154,7 @@ public:
     }
 
     // add UGoPickup to UCommand
-    void addUGoPickup(UCommands & toWorldPickupReqCommand, UGoPickup & toWorldPickupReq)
+    void addUGoPickup(UCommands & toWorldPickupReqCommand, const UGoPickup & toWorldPickupReq)
     {
         UGoPickup * temp_toWorldPickupReq = toWorldPickupReqCommand.add_pickups();
         *temp_toWorldPickupReq = toWorldPickupReq;
@@ -142,7 +175,7 @@ public:
     }
 
     // add UGoDeliver to UCommand
-    void addUGoDeliver(UCommands & toWorldDeliverReqCommand, UGoDeliver & toWorldDeliverReq)
+    void addUGoDeliver(UCommands & toWorldDeliverReqCommand, const UGoDeliver & toWorldDeliverReq)
     {
         UGoDeliver * temp_toWorldDeliverReq = toWorldDeliverReqCommand.add_deliveries();
         *temp_toWorldDeliverReq = toWorldDeliverReq;
@@ -163,7 +196,7 @@ public:
     }
 
     // add UtoALoadRequest to UtoACommand
-    void addUtoALoadRequest(UtoACommand & toAmazonLoadReqCommand, UtoALoadRequest & toAmazonLoadReq)
+    void addUtoALoadRequest(UtoACommand & toAmazonLoadReqCommand, const UtoALoadRequest & toAmazonLoadReq)
     {
         UtoALoadRequest * temp_toAmazonLoadReq = toAmazonLoadReqCommand.add_loadreq();
         *temp_toAmazonLoadReq = toAmazonLoadReq;
@@ -179,7 +212,7 @@ public:
     }
 
     // add Delivery to UtoACommand
-    void addDelivery(UtoACommand & toAmazonDeliveryCommand, Delivery & toAmazonDelivery)
+    void addDelivery(UtoACommand & toAmazonDeliveryCommand, const Delivery & toAmazonDelivery)
     {
         Delivery * temp_delivery = toAmazonDeliveryCommand.add_delivery();
         *temp_delivery = toAmazonDelivery;
@@ -195,7 +228,7 @@ public:
     }
 
     // add UQuery to UCommands
-    void addUQuery(UCommands & worldCommand, UQuery & query)
+    void addUQuery(UCommands & worldCommand, const UQuery & query)
     {
         UQuery * temp_query = worldCommand.add_queries();
         *temp_query = query;
@@ -5,14 +5,17 @@
 #include "world_ups.pb.h"
 #include "logger.hpp"
 #include "constants.hpp"
+#include "connectionPool.hpp"
 #include <array>
-#include <mutex>
 #include <ctime>
 #include <string>
-#include <cstdlib>
+#include <vector>
+#include <cstdint>
 #include <exception>
 #include <pqxx/pqxx>
 
+// every call checks a connection out of the pool, so handlers run their statements concurrently
+// every statement is prepared once per connection and executed with parameters, so postgres parses and plans it once
 class DatabaseLogger
 {
 private:
@@ -24,13 +27,63 @@ private:
         return std::string(asctime(cur_time));
     }
 
-    int getUserId(const std::string & username)
+    // postgres array literal of numbers, like {1,2,3}, passed as one parameter and unnest-ed by the statement
+    template<typename Int>
+    static std::string getArrayLiteral(const std::vector<Int> & values)
+    {
+        std::string literal = "{";
+        for(size_t idx = 0; idx < values.size(); ++idx)
+        {
+            literal += (idx == 0 ? "" : ",") + std::to_string(values[idx]);
+        }
+        return literal + "}";
+    }
+
+    // postgres array literal of strings, every element double quoted with backslash and quote escaped
+    static std::string getArrayLiteral(const std::vector<std::string> & values)
+    {
+        std::string literal = "{";
+        for(size_t idx = 0; idx < values.size(); ++idx)
+        {
+            literal += idx == 0 ? "\"" : ",\"";
+            for(char ch : values[idx])
+            {
+                if(ch == '\\' || ch == '"')
+                {
+                    literal += '\\';
+                }
+                literal += ch;
+            }
+            literal += '"';
+        }
+        return literal + "}";
+    }
+
+    // called on every connection opened by the pool
+    static void prepareStatements(pqxx::connection & conn)
+    {
+        conn.prepare("check_account", "SELECT 1 FROM auth_user WHERE username = $1;");
+        conn.prepare("get_user_id", "SELECT id FROM auth_user WHERE username = $1;");
+        conn.prepare("create_product", "INSERT INTO ups_product (description, count, package_id) VALUES($1, $2, $3);");
+        conn.prepare("create_pkg", "INSERT INTO ups_package (tracking_num, delivery_x, delivery_y, status, creation_time) VALUES($1, $2, $3, $4, $5);");
+        conn.prepare("create_user_pkg", "INSERT INTO ups_package (tracking_num, delivery_x, delivery_y, user_id, status, creation_time) VALUES($1, $2, $3, $4, $5, $6);");
+        conn.prepare("update_pkg_states", "UPDATE ups_package SET status = $2 WHERE tracking_num = ANY($1::bigint[]);");
+        conn.prepare("update_pkg_states_pickup", "UPDATE ups_package SET status = $2, pickup_time = $3 WHERE tracking_num = ANY($1::bigint[]);");
+        conn.prepare("update_pkg_states_delivered", "UPDATE ups_package SET status = $2, delivered_time = $3 WHERE tracking_num = ANY($1::bigint[]);");
+        conn.prepare("create_pkgs", "INSERT INTO ups_package (tracking_num, delivery_x, delivery_y, user_id, status, creation_time) "
+            "SELECT p.tracking_num, p.delivery_x, p.delivery_y, u.id, $5, $6 "
+            "FROM unnest($1::bigint[], $2::integer[], $3::integer[], $4::text[]) AS p(tracking_num, delivery_x, delivery_y, username) "
+            "LEFT JOIN auth_user u ON u.username = p.username;");
+        conn.prepare("create_products", "INSERT INTO ups_product (description, count, package_id) "
+            "SELECT * FROM unnest($1::text[], $2::integer[], $3::bigint[]);");
+        conn.prepare("get_pkg", "SELECT delivery_x, delivery_y FROM ups_package WHERE tracking_num = $1;");
+    }
+
+    int getUserId(pqxx::work & W, const std::string & username)
     {
         try
         {
-            pqxx::work W(*conn);
-            std::string sql = std::string("SELECT id FROM auth_user WHERE username = ") + W.quote(username) + ";";
-            pqxx::result res { W.exec(sql) };
+            pqxx::result res { W.exec_prepared("get_user_id", username) };
             return res.begin()[0].as<int>();
         }
         catch(std::exception & e)
@@ -41,30 +94,18 @@ private:
     }
 
 public:
-    DatabaseLogger()
-    {
-        std::string connect_sql = "dbname=upsdb user=postgres password=abc123";
-        conn = new pqxx::connection(connect_sql);
-        if(conn->is_open()) 
-        {
-            Logger::getInstance()->log("test.log", "Database connection success");
-        } 
-        else 
-        {
-            Logger::getInstance()->log("test.log", "Database connection failure");
-            exit(EXIT_FAILURE);
-        }
-    }
+    explicit DatabaseLogger(size_t poolSize = DB_POOL_SIZE) :
+        pool { "dbname=upsdb user=postgres password=abc123", prepareStatements, poolSize }
+        {}
 
     bool checkAccount(const std::string & account)
     {
         bool ret = false;
         try
         {
-            std::unique_lock<std::mutex> lck(mtx);
+            ConnectionPool::Connection conn(pool);
             pqxx::work W(*conn);
-            std::string sql = std::string("SELECT * FROM auth_user WHERE username = ") + W.quote(account) + ";";
-            pqxx::result res { W.exec(sql) };
+            pqxx::result res { W.exec_prepared("check_account", account) };
             ret = res.begin() != res.end();
         }
         catch(std::exception & e)
@@ -78,11 +119,9 @@ public:
     {
         try
         {
-            std::unique_lock<std::mutex> lck(mtx);
+            ConnectionPool::Connection conn(pool);
             pqxx::work W(*conn);
-            std::string sql = std::string("INSERT INTO ups_product (description, count, package_id) VALUES(")
-                + W.quote(description) + "," + std::to_string(count) + "," + std::to_string(packageId) + ");"; 
-            W.exec(sql);
+            W.exec_prepared("create_product", description, count, packageId);
             W.commit();
         }
         catch(std::exception & e)
@@ -96,13 +135,10 @@ public:
     {
         try
         {
-            std::unique_lock<std::mutex> lck(mtx);
+            ConnectionPool::Connection conn(pool);
             std::string cur_time = getCurrentTime();
             pqxx::work W(*conn);
-            std::string sql = std::string("INSERT INTO ups_package (tracking_num, delivery_x, delivery_y, status, creation_time) VALUES(")
-                + std::to_string(packageid) + "," + std::to_string(dest_x) + "," + std::to_string(dest_y) + 
-                + "," + W.quote(states[CREATED]) + "," + W.quote(cur_time) + ");"; 
-            W.exec(sql);
+            W.exec_prepared("create_pkg", packageid, dest_x, dest_y, states[CREATED], cur_time);
             W.commit();
         }
         catch(std::exception & e)
@@ -112,18 +148,16 @@ public:
         }
     }
 
+    // the user is looked up in the same transaction
     void createPkg(int packageId, int dest_x, int dest_y, const std::string & username)
     {
         try
         {
-            std::unique_lock<std::mutex> lck(mtx);
+            ConnectionPool::Connection conn(pool);
             std::string cur_time = getCurrentTime();
-            int user_id = getUserId(username);
             pqxx::work W(*conn);
-            std::string sql = std::string("INSERT INTO ups_package (tracking_num, delivery_x, delivery_y, user_id, status, creation_time) VALUES(")
-                + std::to_string(packageId) + "," + std::to_string(dest_x) + "," + std::to_string(dest_y) + ", " 
-                + std::to_string(user_id) + "," + W.quote(states[CREATED]) + "," + W.quote(cur_time) + ");"; 
-            W.exec(sql);
+            int user_id = getUserId(W, username);
+            W.exec_prepared("create_user_pkg", packageId, dest_x, dest_y, user_id, states[CREATED], cur_time);
             W.commit();
         }
         catch(std::exception & e)
@@ -135,33 +169,104 @@ public:
     
     void updatePkgState(int packageId, int newState)
     {
-        try
+        updatePkgStates(std::vector<int>(1, packageId), newState);
+    }
+
+    // status and the timestamp of the new state(if any) of every package, in one statement
+    void updatePkgStates(const std::vector<int> & packageIds, int newState)
+    {
+        if(packageIds.empty())
         {
-            std::unique_lock<std::mutex> lck(mtx);
-            std::string state = states[newState];
-            pqxx::work W(*conn);
-            std::string sql = std::string("UPDATE ups_package ")
-                + "SET status = " + W.quote(state)
-                + "WHERE tracking_num = " + std::to_string(packageId) + ";";
+            return;
+        }
+        transact([&](pqxx::work & W) { updatePkgStates(W, packageIds, newState); });
+    }
 
-            // update 
-            std::string cur_time = getCurrentTime();
-            if (newState == OUT_FOR_DELIVERY) 
-            {
-                sql += std::string("UPDATE ups_package ") + "SET pickup_time = " + W.quote(cur_time) + ";";
-            } 
-            else if (newState == DELIVERED) 
+    // same as above, within the transaction W
+    void updatePkgStates(pqxx::work & W, const std::vector<int> & packageIds, int newState)
+    {
+        if(packageIds.empty())
+        {
+            return;
+        }
+        const std::string & state = states[newState];
+        std::string ids = getArrayLiteral(packageIds);
+        std::string cur_time = getCurrentTime();
+        if(newState == OUT_FOR_DELIVERY) 
+        {
+            W.exec_prepared("update_pkg_states_pickup", ids, state, cur_time);
+        } 
+        else if(newState == DELIVERED) 
+        {
+            W.exec_prepared("update_pkg_states_delivered", ids, state, cur_time);
+        }
+        else
+        {
+            W.exec_prepared("update_pkg_states", ids, state);
+        }
+    }
+
+    // every package and product of one pickup request in one transaction and two statements,
+    // packages are created en route, and owners are resolved by joining auth_user(none for an empty or unknown account)
+    void createPickup(const AtoUPickupRequest & pickupReq)
+    {
+        if(pickupReq.shipment_size() == 0)
+        {
+            return;
+        }
+        transact([&](pqxx::work & W) { createPickup(W, pickupReq); });
+    }
+
+    // same as above, within the transaction W
+    void createPickup(pqxx::work & W, const AtoUPickupRequest & pickupReq)
+    {
+        std::vector<int64_t> packageIds;
+        std::vector<int> dest_xs;
+        std::vector<int> dest_ys;
+        std::vector<std::string> usernames;
+        std::vector<std::string> descriptions;
+        std::vector<int> counts;
+        std::vector<int64_t> productPackageIds;
+        for(const ShipInfo & shipment : pickupReq.shipment())
+        {
+            packageIds.push_back(shipment.shipid());
+            dest_xs.push_back(shipment.destination_x());
+            dest_ys.push_back(shipment.destination_y());
+            usernames.push_back(shipment.has_upsaccount() ? shipment.upsaccount() : "");
+            for(const Product & product : shipment.products())
             {
-                sql += std::string("UPDATE ups_package ") + "SET delivered_time = " + W.quote(cur_time) + ";";
+                descriptions.push_back(product.description());
+                counts.push_back(product.count());
+                productPackageIds.push_back(shipment.shipid());
             }
-            
-            W.exec(sql);
+        }
+        if(packageIds.empty())
+        {
+            return;
+        }
+        W.exec_prepared("create_pkgs", getArrayLiteral(packageIds), getArrayLiteral(dest_xs), getArrayLiteral(dest_ys), 
+            getArrayLiteral(usernames), states[TRUCK_EN_ROUTE], getCurrentTime());
+        if(!descriptions.empty())
+        {
+            W.exec_prepared("create_products", getArrayLiteral(descriptions), getArrayLiteral(counts), getArrayLiteral(productPackageIds));
+        }
+    }
+
+    // run fn(W) in one transaction on a connection of the pool and commit it, the error is logged and re-thrown
+    template<typename Fn>
+    void transact(Fn fn)
+    {
+        try
+        {
+            ConnectionPool::Connection conn(pool);
+            pqxx::work W(*conn);
+            fn(W);
             W.commit();
         }
         catch(std::exception & e)
         {
             Logger::getInstance()->log("error.log", "Database error:", e.what());
-            throw e;
+            throw; // keep the type, the caller tells a broken connection from a bad statement
         }
     }
 
@@ -170,13 +275,12 @@ public:
         UDeliveryLocation curPackage;
         try
         {
-            std::unique_lock<std::mutex> lck(mtx);
+            ConnectionPool::Connection conn(pool);
             pqxx::work W(*conn);
-            std::string sql = std::string("SELECT * FROM ups_package WHERE tracking_num = ") + std::to_string(packageId) + ";";
-            pqxx::result res { W.exec(sql) };
+            pqxx::result res { W.exec_prepared("get_pkg", packageId) };
             curPackage.set_packageid(packageId);
-            curPackage.set_x(res.begin()[1].as<int>());
-            curPackage.set_y(res.begin()[2].as<int>());
+            curPackage.set_x(res.begin()[0].as<int>());
+            curPackage.set_y(res.begin()[1].as<int>());
         }
         catch(std::exception & e)
         {
@@ -186,18 +290,8 @@ public:
         return curPackage;
     }
 
-    ~DatabaseLogger() noexcept
-    {
-        if(conn->is_open())
-        {
-            conn->disconnect();
-        }
-        delete(conn);
-    }
-
 private:
-    std::mutex mtx; // cannot read/write database at the same time, need synchronization
-    pqxx::connection * conn;
+    ConnectionPool pool; // a connection is used by one thread at a time
 
     std::array<std::string, 5> states = 
     {
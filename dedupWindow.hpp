@@ -0,0 +1,239 @@
+#ifndef DEDUP_WINDOW_HPP__
+#define DEDUP_WINDOW_HPP__
+
+#include <set>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#define DEDUP_WINDOW_SIZE 4096
+#define DEDUP_OVERFLOW_LIMIT 4096
+#define DEDUP_WORD_NUM (2 * DEDUP_WINDOW_SIZE / 64)
+
+// record of handled sequence numbers received from one peer, with bounded memory
+// (1) every sequence number below the low watermark(base) has been handled
+// (2) [base, base + DEDUP_WINDOW_SIZE) is a bitmap, updated with atomic bit operations
+// (3) anything further is kept in a small overflow set until the window slides over it
+// base moves forward as soon as it's handled; if the overflow set is full, the window is forced forward,
+// sequence numbers skipped this way are older than the whole window and count as handled
+// the bitmap ring is twice the window, so slots of the new top are cleared while still out of the window
+class DedupWindow
+{
+private:
+    static unsigned getWord(int64_t seqNum) { return (seqNum / 64) % DEDUP_WORD_NUM; }
+
+    static uint64_t getMask(int64_t seqNum) { return 1ULL << (seqNum % 64); }
+
+    bool testBit(int64_t seqNum) const { return words[getWord(seqNum)].load() & getMask(seqNum); }
+
+    // set the bit, true if it was not set before
+    bool claimBit(int64_t seqNum) { return !(words[getWord(seqNum)].fetch_or(getMask(seqNum)) & getMask(seqNum)); }
+
+    void clearBit(int64_t seqNum) { words[getWord(seqNum)].fetch_and(~getMask(seqNum)); }
+
+    // move base over every handled sequence number
+    void advance()
+    {
+        std::unique_lock<std::mutex> lck(advance_mtx);
+        int64_t cur = base.load();
+        while(testBit(cur))
+        {
+            // stale slot of the new top, not in the window yet
+            clearBit(cur + DEDUP_WINDOW_SIZE);
+            migrateOverflow(cur + DEDUP_WINDOW_SIZE + 1);
+            base.store(++cur);
+        }
+    }
+
+    // force the window to start at newBase, with advance_mtx held
+    void slideTo(int64_t newBase)
+    {
+        int64_t cur = base.load();
+        if(newBase <= cur)
+        {
+            return;
+        }
+        int64_t clearCnt = newBase - cur < 2 * DEDUP_WINDOW_SIZE ? newBase - cur : 2 * DEDUP_WINDOW_SIZE;
+        for(int64_t idx = 0; idx < clearCnt; ++idx)
+        {
+            clearBit(cur + DEDUP_WINDOW_SIZE + idx);
+        }
+        migrateOverflow(newBase + DEDUP_WINDOW_SIZE);
+        base.store(newBase);
+    }
+
+    // overflow sequence numbers below end go to the bitmap, with advance_mtx held
+    // always done before base is moved, so a sequence number is never in the window without its bit
+    void migrateOverflow(int64_t end)
+    {
+        if(overflowCnt.load() == 0)
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lck(overflow_mtx);
+        while(!overflow.empty() && *overflow.begin() < end)
+        {
+            int64_t seqNum = *overflow.begin();
+            if(seqNum >= end - DEDUP_WINDOW_SIZE)
+            {
+                words[getWord(seqNum)].fetch_or(getMask(seqNum)); // visible in the bitmap before it leaves overflow
+            }
+            overflow.erase(overflow.begin());
+            --overflowCnt;
+        }
+    }
+
+    // slow path for a sequence number beyond the window, serialized with every move of base
+    bool claimOverflow(int64_t seqNum)
+    {
+        {
+            std::unique_lock<std::mutex> lck(advance_mtx);
+            int64_t cur = base.load();
+            if(seqNum < cur)
+            {
+                return false;
+            }
+            if(seqNum < cur + DEDUP_WINDOW_SIZE)
+            {
+                if(!claimBit(seqNum))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                int64_t newBase = 0;
+                {
+                    std::unique_lock<std::mutex> lck(overflow_mtx);
+                    if(!overflow.insert(seqNum).second)
+                    {
+                        return false;
+                    }
+                    ++overflowCnt;
+                    newBase = overflow.size() > DEDUP_OVERFLOW_LIMIT ? *overflow.begin() - DEDUP_WINDOW_SIZE + 1 : 0;
+                }
+                slideTo(newBase);
+            }
+        }
+        advance();
+        return true;
+    }
+
+public:
+    DedupWindow() :
+        base { 0 },
+        overflowCnt { 0 }
+    {
+        for(auto & word : words)
+        {
+            word.store(0);
+        }
+    }
+
+    DedupWindow(const DedupWindow &) = delete;
+    DedupWindow & operator=(const DedupWindow &) = delete;
+
+    // lock-free unless the overflow set is in use
+    bool contains(int64_t seqNum)
+    {
+        if(seqNum < base.load())
+        {
+            return true;
+        }
+        if(overflowCnt.load() > 0)
+        {
+            std::unique_lock<std::mutex> lck(overflow_mtx);
+            if(overflow.count(seqNum) > 0)
+            {
+                return true;
+            }
+        }
+        // checked after overflow, entries are migrated into the bitmap before they leave overflow
+        int64_t cur = base.load();
+        if(seqNum < cur)
+        {
+            return true;
+        }
+        // a cleared bit may belong to a slot reused after base passed seqNum
+        return seqNum < cur + DEDUP_WINDOW_SIZE && (testBit(seqNum) || seqNum < base.load());
+    }
+
+    // atomic check-and-mark, true only for the one caller that marks seqNum first
+    bool tryInsert(int64_t seqNum)
+    {
+        int64_t cur = base.load();
+        if(seqNum < cur)
+        {
+            return false;
+        }
+        if(seqNum >= cur + DEDUP_WINDOW_SIZE)
+        {
+            return claimOverflow(seqNum);
+        }
+        if(!claimBit(seqNum))
+        {
+            return false;
+        }
+        if(testBit(base.load()))
+        {
+            advance();
+        }
+        return true;
+    }
+
+    // every sequence number below it has been handled
+    int64_t getLowWatermark() const { return base.load(); }
+
+    // every sequence number below the returned watermark has been handled, and those in handled above it
+    // consistent while it runs, base doesn't move meanwhile
+    int64_t getHandled(std::vector<int64_t> & handled)
+    {
+        std::unique_lock<std::mutex> lck(advance_mtx);
+        int64_t cur = base.load();
+        for(int64_t seqNum = cur; seqNum < cur + DEDUP_WINDOW_SIZE; ++seqNum)
+        {
+            if(testBit(seqNum))
+            {
+                handled.push_back(seqNum);
+            }
+        }
+        std::unique_lock<std::mutex> overflowLck(overflow_mtx);
+        handled.insert(handled.end(), overflow.begin(), overflow.end());
+        return cur;
+    }
+
+    // forget every handled sequence number, the peer starts a new sequence space
+    // not safe against concurrent callers, only used before any sequence number of the new space is handled
+    void clear()
+    {
+        std::unique_lock<std::mutex> lck(advance_mtx);
+        std::unique_lock<std::mutex> overflowLck(overflow_mtx);
+        for(auto & word : words)
+        {
+            word.store(0);
+        }
+        overflow.clear();
+        overflowCnt.store(0);
+        base.store(0);
+    }
+
+    // mark every sequence number below watermark as handled, used to restore a window
+    void setLowWatermark(int64_t watermark)
+    {
+        {
+            std::unique_lock<std::mutex> lck(advance_mtx);
+            slideTo(watermark);
+        }
+        advance();
+    }
+
+private:
+    std::atomic<int64_t> base;
+    std::atomic<uint64_t> words[DEDUP_WORD_NUM];
+    std::mutex advance_mtx; // only one thread moves base at a time, always locked before overflow_mtx
+    std::mutex overflow_mtx;
+    std::set<int64_t> overflow;
+    std::atomic<unsigned> overflowCnt; // size of overflow, checked without the lock
+};
+
+#endif
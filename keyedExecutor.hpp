@@ -0,0 +1,106 @@
+#ifndef KEYED_EXECUTOR_HPP__
+#define KEYED_EXECUTOR_HPP__
+
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// tasks with the same key run one after another in submission order on the same lane,
+// tasks with different keys may run in parallel on different lanes
+class KeyedExecutor
+{
+private:
+    struct Lane
+    {
+        Lane() : stopped { false } {}
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stopped;
+        std::queue<std::function<void()>> tasks;
+        std::thread worker;
+    };
+
+    static void laneLoop(Lane * lane)
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lck(lane->mtx);
+                lane->cv.wait(lck, [&](){ return lane->stopped || !lane->tasks.empty(); });
+                if(lane->stopped && lane->tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(lane->tasks.front()); lane->tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    // one lane per core by default
+    explicit KeyedExecutor(unsigned laneCnt = std::thread::hardware_concurrency())
+    {
+        if(laneCnt == 0)
+        {
+            laneCnt = 1;
+        }
+        for(unsigned idx = 0; idx < laneCnt; ++idx)
+        {
+            lanes.push_back(new Lane);
+            lanes.back()->worker = std::thread(&KeyedExecutor::laneLoop, lanes.back());
+        }
+    }
+
+    KeyedExecutor(const KeyedExecutor &) = delete;
+    KeyedExecutor & operator=(const KeyedExecutor &) = delete;
+
+    void submit(unsigned key, std::function<void()> task)
+    {
+        Lane * lane = lanes[key % lanes.size()];
+        {
+            std::unique_lock<std::mutex> lck(lane->mtx);
+            lane->tasks.push(std::move(task));
+        }
+        lane->cv.notify_one();
+    }
+
+    unsigned getLaneCount() const { return lanes.size(); }
+
+    // tasks waiting on all lanes
+    unsigned getQueueDepth()
+    {
+        unsigned depth = 0;
+        for(Lane * lane : lanes)
+        {
+            std::unique_lock<std::mutex> lck(lane->mtx);
+            depth += lane->tasks.size();
+        }
+        return depth;
+    }
+
+    // drain queued tasks, then join all lanes
+    ~KeyedExecutor() noexcept
+    {
+        for(Lane * lane : lanes)
+        {
+            {
+                std::unique_lock<std::mutex> lck(lane->mtx);
+                lane->stopped = true;
+            }
+            lane->cv.notify_all();
+            lane->worker.join();
+            delete(lane);
+        }
+    }
+
+private:
+    std::vector<Lane *> lanes;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef OUTSTANDING_TABLE_HPP__
+#define OUTSTANDING_TABLE_HPP__
+
+#include "sharded_unordered_map.hpp"
+#include <string>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+// every un-acknowledged message sent to one peer, kept in a ShardedUnorderedMap keyed by sequence number
+// consecutive sequence numbers land on different shards, so senders and acks running on different cores rarely share a lock,
+// and every operation touches one shard and takes its lock exactly once
+// every entry keeps its retransmission deadline, the timer wheel of the peer indexes the deadlines,
+// so a resend only looks up the entries whose timer has expired
+class OutstandingTable
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        Entry() : kind { 0 }, retries { 0 } {}
+
+        Entry(unsigned _kind, std::shared_ptr<const std::string> _payload, unsigned rtoMs) :
+            kind { _kind },
+            sentTime { Clock::now() },
+            deadline { sentTime + std::chrono::milliseconds(rtoMs) },
+            retries { 0 },
+            payload { _payload }
+            {}
+
+        unsigned kind; // message type, tells which field of the command the payload is spliced into
+        Clock::time_point sentTime; // first transmission
+        Clock::time_point deadline; // resent if not ack-ed by then
+        unsigned retries;
+        std::shared_ptr<const std::string> payload; // serialized message, shared and never re-encoded on resend
+    };
+
+public:
+    OutstandingTable() = default;
+    OutstandingTable(const OutstandingTable &) = delete;
+    OutstandingTable & operator=(const OutstandingTable &) = delete;
+
+    void insert(unsigned seqNum, const Entry & entry)
+    {
+        entries.insert(seqNum, entry);
+    }
+
+    // remove an ack-ed message and hand it back, false if it is not outstanding(ack-ed before)
+    bool erase(unsigned seqNum, Entry & entry)
+    {
+        return entries.erase_if(seqNum, [&entry](Entry & removed)
+        {
+            entry = std::move(removed);
+            return true;
+        });
+    }
+
+    // remove every ack-ed message of seqNums, each shard is locked once,
+    // the removed entries are appended to removed
+    void erase(std::vector<unsigned> & seqNums, std::vector<Entry> & removed)
+    {
+        entries.erase_all(seqNums, [&removed](Entry & entry)
+        {
+            removed.push_back(std::move(entry));
+        });
+    }
+
+    // copy of an outstanding message, false if it is not outstanding
+    bool find(unsigned seqNum, Entry & entry)
+    {
+        return entries.find(seqNum, entry);
+    }
+
+    // count one more transmission of an expired message, give it rtoMs more and hand it back, false if ack-ed meanwhile
+    bool retry(unsigned seqNum, unsigned rtoMs, Entry & entry)
+    {
+        return entries.visit(seqNum, [rtoMs, &entry](Entry & outstanding)
+        {
+            ++outstanding.retries;
+            outstanding.deadline = Clock::now() + std::chrono::milliseconds(rtoMs);
+            entry = outstanding;
+        });
+    }
+
+    // put off the deadline of an expired message not resent this time, false if ack-ed meanwhile
+    bool postpone(unsigned seqNum, unsigned delayMs)
+    {
+        return entries.visit(seqNum, [delayMs](Entry & outstanding)
+        {
+            outstanding.deadline = Clock::now() + std::chrono::milliseconds(delayMs);
+        });
+    }
+
+    // call fn(seqNum, entry) on every outstanding message, one shard locked at a time, nothing is copied
+    template<typename Fn>
+    void forEach(Fn fn)
+    {
+        entries.for_each_if([](unsigned, const Entry &) { return true; }, fn);
+    }
+
+    size_t size()
+    {
+        return entries.size();
+    }
+
+private:
+    ShardedUnorderedMap<unsigned, Entry> entries;
+};
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef REACTOR_HPP__
+#define REACTOR_HPP__
+
+#include "socket.hpp"
+#include "logger.hpp"
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+#include <functional>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define MAX_EPOLL_EVENTS 64
+
+// single-threaded epoll event loop owning the fds of attached sockets
+// received frames are handed to the channel callback on the reactor thread, so the callback should only dispatch;
+// frames queued by Socket::sendMsg() from any thread are written here, a slow peer only grows its own queue
+// periodic timers also run on the reactor thread, between socket events
+class Reactor
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Timer
+    {
+        std::chrono::milliseconds interval;
+        Clock::time_point next;
+        std::function<void()> callback;
+    };
+
+    struct Channel
+    {
+        Socket * socket;
+        std::function<void(const std::string &)> onFrame;
+        std::function<void()> onClose;
+        std::atomic<bool> flushRequested;
+        bool closed;
+    };
+
+    void closeChannel(Channel * channel)
+    {
+        if(channel->closed)
+        {
+            return;
+        }
+        channel->closed = true;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, channel->socket->getFd(), NULL);
+        channel->onClose();
+    }
+
+    void handleReadable(Channel * channel)
+    {
+        std::vector<std::string> frames;
+        bool alive = channel->socket->readFrames(frames);
+        for(const std::string & frame : frames)
+        {
+            channel->onFrame(frame);
+        }
+        if(!alive)
+        {
+            closeChannel(channel);
+        }
+    }
+
+    void handleWritable(Channel * channel)
+    {
+        channel->flushRequested = false;
+        if(!channel->socket->flushFrames())
+        {
+            closeChannel(channel);
+        }
+    }
+
+    // some sender has queued frames, flush the channels asking for it
+    void handleWakeup()
+    {
+        uint64_t cnt;
+        while(read(wakefd, &cnt, sizeof(cnt)) > 0) {}
+        std::vector<Channel *> snapshot;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            snapshot = channels;
+        }
+        for(Channel * channel : snapshot)
+        {
+            if(!channel->closed && channel->flushRequested)
+            {
+                handleWritable(channel);
+            }
+        }
+    }
+
+    // milliseconds until the earliest timer is due, -1 if there's no timer
+    int getTimeout()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        if(timers.empty())
+        {
+            return -1;
+        }
+        Clock::time_point earliest = timers.front().next;
+        for(const Timer & timer : timers)
+        {
+            earliest = std::min(earliest, timer.next);
+        }
+        // round up, a wait under 1ms truncated to 0 would make epoll_wait return at once and spin until the timer is due
+        Clock::duration remaining = earliest - Clock::now();
+        if(remaining <= Clock::duration::zero())
+        {
+            return 0;
+        }
+        std::chrono::milliseconds wait = std::chrono::duration_cast<std::chrono::milliseconds>(remaining);
+        if(wait < remaining)
+        {
+            ++wait;
+        }
+        return wait.count();
+    }
+
+    void runTimers()
+    {
+        std::vector<std::function<void()>> due;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            Clock::time_point now = Clock::now();
+            for(Timer & timer : timers)
+            {
+                if(timer.next <= now)
+                {
+                    due.push_back(timer.callback);
+                    timer.next = now + timer.interval;
+                }
+            }
+        }
+        for(auto & callback : due)
+        {
+            callback();
+        }
+    }
+
+public:
+    Reactor() :
+        epfd { epoll_create1(0) },
+        wakefd { eventfd(0, EFD_NONBLOCK) },
+        stopped { false }
+    {
+        if(epfd == -1 || wakefd == -1)
+        {
+            std::cerr << "reactor creation error" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL; // wakeup fd
+        epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+    }
+
+    Reactor(const Reactor &) = delete;
+    Reactor & operator=(const Reactor &) = delete;
+
+    // hand a connected socket over to the reactor, it becomes non-blocking from now on
+    // onFrame receives every complete frame, onClose is called once when the peer closes or errs
+    void addSocket(Socket * socket, std::function<void(const std::string &)> onFrame, std::function<void()> onClose)
+    {
+        Channel * channel = new Channel;
+        channel->socket = socket;
+        channel->onFrame = onFrame;
+        channel->onClose = onClose;
+        channel->flushRequested = true; // frames queued before attaching, if any
+        channel->closed = false;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            channels.push_back(channel);
+        }
+        socket->attach([this, channel]()
+        {
+            if(!channel->flushRequested.exchange(true))
+            {
+                wakeup();
+            }
+        });
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = channel;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, socket->getFd(), &ev);
+        wakeup();
+    }
+
+    // run callback on the reactor thread every intervalMs milliseconds
+    void addTimer(unsigned intervalMs, std::function<void()> callback)
+    {
+        Timer timer;
+        timer.interval = std::chrono::milliseconds(intervalMs);
+        timer.next = Clock::now() + timer.interval;
+        timer.callback = callback;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            timers.push_back(timer);
+        }
+        wakeup();
+    }
+
+    void wakeup()
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(wakefd, &one, sizeof(one));
+        (void)ret; // counter overflow is impossible, EAGAIN means a wakeup is already pending
+    }
+
+    // run the event loop on the calling thread until stop()
+    void run()
+    {
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        while(!stopped)
+        {
+            int cnt = epoll_wait(epfd, events, MAX_EPOLL_EVENTS, getTimeout());
+            if(cnt < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                Logger::getInstance()->log("error.log", "epoll_wait() error: ", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            for(int idx = 0; idx < cnt; ++idx)
+            {
+                Channel * channel = static_cast<Channel *>(events[idx].data.ptr);
+                if(channel == NULL)
+                {
+                    handleWakeup();
+                    continue;
+                }
+                if(channel->closed)
+                {
+                    continue;
+                }
+                if(events[idx].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    handleReadable(channel);
+                }
+                if(!channel->closed && (events[idx].events & EPOLLOUT))
+                {
+                    handleWritable(channel);
+                }
+            }
+            runTimers();
+        }
+    }
+
+    void stop()
+    {
+        stopped = true;
+        wakeup();
+    }
+
+    ~Reactor() noexcept
+    {
+        close(epfd);
+        close(wakefd);
+        for(Channel * channel : channels)
+        {
+            delete(channel);
+        }
+    }
+
+private:
+    int epfd;
+    int wakefd;
+    std::atomic<bool> stopped;
+    std::mutex mtx; // guard channels and timers, they may be added while running
+    std::vector<Channel *> channels;
+    std::vector<Timer> timers;
+};
+
+#endif
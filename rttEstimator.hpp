@@ -0,0 +1,66 @@
+#ifndef RTT_ESTIMATOR_HPP__
+#define RTT_ESTIMATOR_HPP__
+
+#include <mutex>
+#include <cstdlib>
+#include <algorithm>
+#define RTO_INITIAL_MS 1000
+#define RTO_MIN_MS 50
+#define RTO_MAX_MS 60000
+#define RTO_MAX_BACKOFF_SHIFT 6
+
+// retransmission timeout of one peer, Jacobson/Karels style (as TCP, RFC 6298):
+// srtt and rttvar are smoothed from round trip samples, rto = srtt + 4 * rttvar,
+// and doubled on every retransmission of the same message
+// samples must only come from messages acked without being resent (Karn's algorithm)
+class RttEstimator
+{
+public:
+    RttEstimator(unsigned initialRtoMs = RTO_INITIAL_MS) :
+        hasSample { false },
+        srtt { 0 },
+        rttvar { 0 },
+        rto { initialRtoMs }
+        {}
+
+    void addSample(unsigned rttMs)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        if(!hasSample)
+        {
+            srtt = rttMs;
+            rttvar = rttMs / 2;
+            hasSample = true;
+        }
+        else
+        {
+            int delta = static_cast<int>(srtt) - static_cast<int>(rttMs);
+            rttvar = (3 * rttvar + static_cast<unsigned>(abs(delta))) / 4;
+            srtt = (7 * srtt + rttMs) / 8;
+        }
+        rto = std::min(std::max(srtt + std::max(1u, 4 * rttvar), static_cast<unsigned>(RTO_MIN_MS)), static_cast<unsigned>(RTO_MAX_MS));
+    }
+
+    // timeout for a message already sent retries times, exponential backoff on repeated loss
+    unsigned getRto(unsigned retries)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        unsigned shift = std::min(retries, static_cast<unsigned>(RTO_MAX_BACKOFF_SHIFT));
+        return std::min(rto << shift, static_cast<unsigned>(RTO_MAX_MS));
+    }
+
+    unsigned getSrtt()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        return srtt;
+    }
+
+private:
+    std::mutex mtx;
+    bool hasSample;
+    unsigned srtt; // smoothed round trip time, in ms
+    unsigned rttvar; // round trip time variance, in ms
+    unsigned rto; // retransmission timeout before backoff, in ms
+};
+
+#endif
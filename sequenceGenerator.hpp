@@ -5,229 +5,452 @@
 #include "world_ups.pb.h"
 #include "socket.hpp"
 #include "logger.hpp"
+#include "constants.hpp"
 #include "dataGenerator.hpp"
-#include "threadsafe_unordered_map.hpp"
+#include "timerWheel.hpp"
+#include "rttEstimator.hpp"
+#include "dedupWindow.hpp"
+#include "outstandingTable.hpp"
+#include "writeAheadLog.hpp"
+#include "tokenBucket.hpp"
+#include "sharded_unordered_map.hpp"
 #include <mutex>
 #include <queue>
 #include <vector>
 #include <thread>
 #include <string>
 #include <atomic>
+#include <memory>
+#include <chrono>
 #include <climits>
 #include <cstdlib>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#define RESEND_FRAME_BYTES 65536
+#define RESEND_DEFER_MS 10
 
-// sent_threshold and check_sent_exceed() is for resend un-acknowledged sent message
-// every 30 second, if message not ack-ed, it will be re-sent
-// recv_threshold and check_recv_exceed() is for avoid re-handling request, like access database
-// every 120 minutes, it should be no communication problem(un-acked); then clear the record to save space 
-#define SENT_THRESHOLD 30
-#define RECV_THRESHOLD 120
-#define CHECK_SENT_EXCEED(val1, val2) abs((val1) - (val2)) >= SENT_THRESHOLD
-#define CHECK_RECV_EXCEED(val1, val2) abs((val1) - (val2)) >= RECV_THRESHOLD
+// world and Amazon have separate sequence spaces: numbers, acks, timers and handled records of one never touch the other
+// every sent message is kept in the outstanding table of its peer and arms a retransmission timer, if not ack-ed within the retransmission timeout(rto) of its peer,
+// it will be re-sent and re-armed with a doubled timeout; rto of each peer adapts to the measured round trip time
+// resends of a peer are paced by its token bucket, oldest first, in frames of RESEND_FRAME_BYTES at most,
+// and queued behind fresh traffic on the socket; those over budget are deferred to a later cycle
+// every received/handled sequence number is recorded in a DedupWindow of its peer, to avoid re-handling request,
+// like access database; the window slides by itself, so the record never needs to be cleared
+// a received sequence number is claimed in memory while its request is handled, and only recorded as handled
+// once the effects of the request are durable, so a request lost by a crash is handled again when the peer retransmits it
+// once recovered from a WriteAheadLog, sent messages, acks and handled sequence numbers are logged, and survive a restart
 
 class SequenceGenerator
 {
 private:
-    using UGoPickup_with_time = std::pair<int, UGoPickup>;
-    using UGoDeliver_with_time = std::pair<int, UGoDeliver>;
-    using UQuery_with_time = std::pair<int, UQuery>;
-    using UtoALoadRequest_with_time = std::pair<int, UtoALoadRequest>;
-    using Delivery_with_time = std::pair<int, Delivery>;
-    using UserValidationResponse_with_time = std::pair<int, UserValidationResponse>;
+    using Clock = std::chrono::steady_clock;
 
 private:
-    int getCurrentSecond() const
+    static int getPeer(unsigned msgType)
     {
-        time_t cur = time(NULL);
-        tm * tm = localtime(&cur);
-        return tm->tm_sec;
+        return msgType <= TO_WORLD_QUERY_REQ ? WORLD_PEER : AMAZON_PEER;
     }
 
-    int getTimestamp() const
+    // record a sent message, encoded once, and arm its retransmission timer
+    // its log record is only queued, the sender never waits on disk: the HANDLED record of the request sending it
+    // is appended later, so by the time that request is ack-ed the group commit has put this record on disk too
+    template<typename T>
+    void registerSentMessage(unsigned seqNum, unsigned msgType, const T & msg)
     {
-        time_t cur = time(NULL);
-        tm * tm = localtime(&cur);
-        int minVal = tm->tm_min;
-        int secVal = tm->tm_sec;
-        return minVal * 60 + secVal;
+        int peer = getPeer(msgType);
+        std::shared_ptr<const std::string> payload = std::make_shared<std::string>(msg.SerializeAsString());
+        unsigned rtoMs = rtt[peer].getRto(0);
+        outstanding[peer].insert(seqNum, OutstandingTable::Entry(msgType, payload, rtoMs));
+        retransmitTimers[peer].schedule(seqNum, rtoMs);
+        if(wal != nullptr)
+        {
+            wal->append(WriteAheadLog::WAL_SENT, peer, msgType, seqNum, *payload);
+        }
     }
 
-    void resendAmazonMessage(Socket * amazonSocket, int cur_second)
+    void raiseSeqNumber(int peer, int64_t next)
     {
-        UtoACommand toAmazonCommand;
-        std::vector<UtoALoadRequest_with_time> unackedUtoALoadRequest = toAmazonLoadReqs.getAllValue();
-        for(auto & msg : unackedUtoALoadRequest)
+        if(seq[peer].load() < next)
         {
-            if(CHECK_SENT_EXCEED(msg.first, cur_second))
-            {
-                DataGenerator::getInstance()->addUtoALoadRequest(toAmazonCommand, msg.second);
-            }
+            seq[peer].store(next);
         }
-        std::vector<Delivery_with_time> unackedDelivery = toAmazonDeliveries.getAllValue();
-        for(auto & msg : unackedDelivery)
+    }
+
+    // drop every handled sequence number and un-acked message of peer, its sequence space is gone
+    void resetPeer(int peer)
+    {
+        std::vector<unsigned> seqNums;
+        outstanding[peer].forEach([&seqNums](unsigned seqNum, const OutstandingTable::Entry &) { seqNums.push_back(seqNum); });
+        retransmitTimers[peer].cancel(seqNums);
+        std::vector<OutstandingTable::Entry> removed;
+        outstanding[peer].erase(seqNums, removed);
+        seq_handled[peer].clear();
+    }
+
+    // the state of WORLD_PEER belongs to world _worldid from now on, reset if it belonged to another one
+    bool switchWorld(int64_t _worldid)
+    {
+        if(_worldid == worldid)
         {
-            if(CHECK_SENT_EXCEED(msg.first, cur_second))
-            {
-                DataGenerator::getInstance()->addDelivery(toAmazonCommand, msg.second);
-            }
+            return false;
+        }
+        resetPeer(WORLD_PEER);
+        worldid = _worldid;
+        return true;
+    }
+
+    // apply one record of the write-ahead log on recovery, every record can be applied more than once
+    void replayRecord(WriteAheadLog::Record & record)
+    {
+        int peer = record.peer;
+        if(peer >= PEER_NUM)
+        {
+            return;
         }
-        std::vector<UserValidationResponse_with_time> unackedUserValidationResponse = toAmazonUserValidationReses.getAllValue();
-        for(auto & msg : unackedUserValidationResponse)
+        switch(record.type)
         {
-            if(CHECK_SENT_EXCEED(msg.first, cur_second))
+            case WriteAheadLog::WAL_SENT:
+            {
+                raiseSeqNumber(peer, record.seqNum + 1);
+                OutstandingTable::Entry entry(record.kind, std::make_shared<std::string>(std::move(record.payload)), rtt[peer].getRto(1));
+                entry.retries = 1; // sent before the restart, its ack can't be timed
+                outstanding[peer].insert(record.seqNum, entry);
+                break;
+            }
+            case WriteAheadLog::WAL_ACK:
             {
-                DataGenerator::getInstance()->addUserValidationResponse(toAmazonCommand, msg.second);
+                raiseSeqNumber(peer, record.seqNum + 1);
+                OutstandingTable::Entry entry;
+                outstanding[peer].erase(record.seqNum, entry);
+                break;
             }
+            case WriteAheadLog::WAL_HANDLED: seq_handled[peer].tryInsert(record.seqNum); break;
+            case WriteAheadLog::WAL_WATERMARK: seq_handled[peer].setLowWatermark(record.seqNum); break;
+            case WriteAheadLog::WAL_NEXT_SEQ: raiseSeqNumber(peer, record.seqNum); break;
+            case WriteAheadLog::WAL_WORLD_ID: switchWorld(record.seqNum); break;
+            default: break;
         }
-        amazonSocket->sendMsg(toAmazonCommand);
-        Logger::getInstance()->log("amazon.log", "Resend amazon message:\n", toAmazonCommand.DebugString());
     }
 
-    void resendWorldMessage(Socket * worldSocket, int cur_second)
+    // queue the resent messages as one low priority frame, and start a new one
+    static void sendResendFrame(int peer, Socket * socket, std::string & command, std::string & seqNums)
     {
-        UCommands toWorldCommand;
-        std::vector<UGoPickup_with_time> unackedUGoPickup = toWorldPickupReqs.getAllValue();
-        for(auto & msg : unackedUGoPickup)
+        if(command.empty())
         {
-            if(CHECK_SENT_EXCEED(msg.first, cur_second))
-            {
-                DataGenerator::getInstance()->addUGoPickup(toWorldCommand, msg.second);
-            }
+            return;
+        }
+        socket->sendFrame(command, true);
+        Logger::getInstance()->log(peer == WORLD_PEER ? "world.log" : "amazon.log", "Resend message, sequence number:", seqNums);
+        command.clear();
+        seqNums.clear();
+    }
+
+    // field of UCommands/UtoACommand a message type goes to
+    static int getFieldNumber(unsigned msgType)
+    {
+        switch(msgType)
+        {
+            case TO_WORLD_PICKUP_REQ: return UCommands::kPickupsFieldNumber;
+            case TO_WORLD_DELIVER_REQ: return UCommands::kDeliveriesFieldNumber;
+            case TO_WORLD_QUERY_REQ: return UCommands::kQueriesFieldNumber;
+            case TO_AMAZON_LOAD_REQ: return UtoACommand::kLoadReqFieldNumber;
+            case TO_AMAZON_DELIVERY: return UtoACommand::kDeliveryFieldNumber;
+            default: return UtoACommand::kUsrVlidFieldNumber;
         }
-        std::vector<UGoDeliver_with_time> unackedUGoDeliver = toWorldDeliverReqs.getAllValue();
-        for(auto & msg : unackedUGoDeliver)
+    }
+
+public:
+    // initialRtoMs is used for a peer until its first round trip sample
+    explicit SequenceGenerator(unsigned initialRtoMs = RTO_INITIAL_MS) : 
+        rtt { { initialRtoMs }, { initialRtoMs } },
+        worldid { -1 },
+        wal { nullptr }
+    {
+        for(auto & peerSeq : seq)
         {
-            if(CHECK_SENT_EXCEED(msg.first, cur_second))
-            {
-                DataGenerator::getInstance()->addUGoDeliver(toWorldCommand, msg.second);
-            }
+            peerSeq.store(0);
         }
-        std::vector<UQuery_with_time> unackedUQuery = toWorldQueryReqs.getAllValue();
-        for(auto & msg : unackedUQuery)
+    }
+
+    // rebuild the state left by the last run from the log, and log every change from now on
+    // called once on startup, before any message is sent or received; recovered messages are resent once their timer expires
+    void recover(WriteAheadLog * _wal)
+    {
+        size_t recordCnt = _wal->replay([this](WriteAheadLog::Record & record) { replayRecord(record); });
+        size_t resendCnt = 0;
+        Clock::time_point now = Clock::now();
+        for(int peer = 0; peer < PEER_NUM; ++peer)
         {
-            if(CHECK_SENT_EXCEED(msg.first, cur_second))
+            outstanding[peer].forEach([this, peer, now, &resendCnt](unsigned seqNum, const OutstandingTable::Entry & entry)
             {
-                DataGenerator::getInstance()->addUQuery(toWorldCommand, msg.second);
-            }
+                retransmitTimers[peer].schedule(seqNum, entry.deadline > now ? std::chrono::duration_cast<std::chrono::milliseconds>(entry.deadline - now).count() : 0);
+                ++resendCnt;
+            });
         }
-        worldSocket->sendMsg(toWorldCommand);
-        Logger::getInstance()->log("world.log", "Resend to world message:\n", toWorldCommand.DebugString());
+        wal = _wal;
+        Logger::getInstance()->log("test.log", "Recover ", recordCnt, " records from write-ahead log, ", resendCnt, " messages to resend");
     }
 
-public:
-    SequenceGenerator() : 
-        seq { 0 }
-        {}
+    // world the recovered state of WORLD_PEER belongs to, -1 if none
+    int64_t getWorldId() const { return worldid; }
 
-    // for UPS as send side, register every used sequence number
-    unsigned getSeqNumber()
+    // connected to world _worldid, called once on startup after recover(), before any message is exchanged with world
+    // a new world never saw the recovered messages and numbers its own from 0, so if it's not the world of the
+    // recovered state, every handled sequence number and un-acked message of WORLD_PEER is dropped
+    void setWorldId(int64_t _worldid)
     {
-        while(seq_sent.find(seq))
+        int64_t lastWorldid = worldid;
+        if(!switchWorld(_worldid))
+        {
+            return;
+        }
+        if(lastWorldid >= 0)
+        {
+            Logger::getInstance()->log("world.log", "World ", lastWorldid, " is gone, drop its state and start over in world ", _worldid);
+        }
+        if(wal != nullptr)
         {
-            ++seq; // make sure sequence number is not occupied at present
+            wal->waitDurable(wal->append(WriteAheadLog::WAL_WORLD_ID, WORLD_PEER, 0, worldid));
         }
-        seq_sent.insert(seq, 0); // initial value, act as place holder
-        return seq++; 
     }
 
-    // for UPS as send side, remove every used sequence number
-    void receiveAck(unsigned ack)
+    // rewrite the log as a snapshot of the current state once it has grown past WAL_COMPACT_RECORDS records
+    void compactLog()
     {
-        if(!seq_sent.find(ack))
+        if(wal == nullptr || !wal->needsCompaction() || !wal->beginCompaction())
         {
             return;
         }
-
-        unsigned msgType = seq_sent.get(ack);
-        seq_sent.erase(ack);
-        switch(msgType)
+        if(worldid >= 0) // first, so replaying the snapshot never resets the state below
         {
-            case TO_WORLD_PICKUP_REQ: toWorldPickupReqs.erase(ack); break;
-            case TO_WORLD_DELIVER_REQ: toWorldDeliverReqs.erase(ack); break;
-            case TO_WORLD_QUERY_REQ: toWorldQueryReqs.erase(ack); break;
-            case TO_AMAZON_LOAD_REQ: toAmazonLoadReqs.erase(ack); break;
-            case TO_AMAZON_DELIVERY: toAmazonDeliveries.erase(ack); break;
-            case TO_AMAZON_USER_VALID: toAmazonUserValidationReses.erase(ack); break;
-            default: break;
+            wal->addSnapshotRecord(WriteAheadLog::WAL_WORLD_ID, WORLD_PEER, 0, worldid);
+        }
+        std::vector<int64_t> handled;
+        for(int peer = 0; peer < PEER_NUM; ++peer)
+        {
+            wal->addSnapshotRecord(WriteAheadLog::WAL_NEXT_SEQ, peer, 0, seq[peer].load());
+            handled.clear();
+            int64_t watermark = seq_handled[peer].getHandled(handled);
+            wal->addSnapshotRecord(WriteAheadLog::WAL_WATERMARK, peer, 0, watermark);
+            for(int64_t seqNum : handled)
+            {
+                wal->addSnapshotRecord(WriteAheadLog::WAL_HANDLED, peer, 0, seqNum);
+            }
+            outstanding[peer].forEach([this, peer](unsigned seqNum, const OutstandingTable::Entry & entry)
+            {
+                wal->addSnapshotRecord(WriteAheadLog::WAL_SENT, peer, entry.kind, seqNum, *entry.payload);
+            });
         }
+        wal->endCompaction();
     }
 
-    // record every received/handle sequence number, in order to avoid re-handling
-    void addHandledRequest(int seqNum)
+    // for UPS as send side, every call gets a distinct sequence number of peer without any lock,
+    // the retransmission table is only touched when the message is registered by addSentMessage()
+    unsigned getSeqNumber(int peer)
     {
-        seq_handled.insert(seqNum, getTimestamp());
+        return seq[peer].fetch_add(1);
     }
 
-    // check if the sequence has been handled
-    bool checkAlreadyHandled(int seqNum)
+    // for UPS as send side, remove the sequence number ack-ed by peer
+    void receiveAck(int peer, unsigned ack)
     {
-        return seq_handled.find(seqNum);
+        receiveAcks(peer, &ack, 1);
     }
 
-    // clear record to save space
-    void clearHandledRequest()
+    // for UPS as send side, remove every sequence number ack-ed by one frame of peer
+    // each shard of the outstanding table is locked once and all timers are cancelled under one lock,
+    // the round trip is sampled once per frame, from the latest message sent only once, as TCP times one segment per ack
+    template<typename Int>
+    void receiveAcks(int peer, const Int * acks, int ackCnt)
     {
-        int curTimestamp = getTimestamp();
-        std::vector<unsigned> seqs = seq_handled.getAllKey();
-        for(unsigned seq : seqs)
+        std::vector<unsigned> seqNums(acks, acks + ackCnt);
+        std::vector<OutstandingTable::Entry> removed;
+        removed.reserve(ackCnt);
+        outstanding[peer].erase(seqNums, removed);
+        retransmitTimers[peer].cancel(seqNums);
+        if(wal != nullptr)
         {
-            int temp_timestamp = seq_handled.get(seq);
-            if(CHECK_RECV_EXCEED(curTimestamp, temp_timestamp))
+            for(unsigned seqNum : seqNums)
             {
-                seq_handled.erase(seq);
+                wal->append(WriteAheadLog::WAL_ACK, peer, 0, seqNum); // not waited, a lost ack record only costs one more resend
             }
         }
+        Clock::time_point latest;
+        bool hasSample = false;
+        for(const OutstandingTable::Entry & entry : removed)
+        {
+            if(entry.retries == 0 && (!hasSample || entry.sentTime > latest))
+            {
+                latest = entry.sentTime;
+                hasSample = true;
+            }
+        }
+        if(hasSample)
+        {
+            rtt[peer].addSample(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - latest).count());
+        }
+    }
+
+    // the repeated acks/ack field of a parsed UResponses/AtoUCommand
+    template<typename Int>
+    void receiveAcks(int peer, const google::protobuf::RepeatedField<Int> & acks)
+    {
+        receiveAcks(peer, acks.data(), acks.size());
+    }
+
+    // record every received/handle sequence number, in order to avoid re-handling
+    // claim the sequence number received from peer for handling, true only for the first caller,
+    // false if it has been handled or is being handled; the claim is kept in memory until completeClaim()
+    bool tryClaim(int peer, int64_t seqNum)
+    {
+        if(seq_handled[peer].contains(seqNum) || !inFlight[peer].find_or_insert(seqNum, true).second)
+        {
+            return false;
+        }
+        if(seq_handled[peer].contains(seqNum)) // completed by another caller since the first check
+        {
+            inFlight[peer].erase(seqNum);
+            return false;
+        }
+        return true;
+    }
+
+    // the request claimed by tryClaim() has been handled and its effects are durable, record it as handled,
+    // then() is called once the record is on disk, like to ack the request, maybe by the thread syncing the log
+    void completeClaim(int peer, int64_t seqNum, std::function<void()> then)
+    {
+        seq_handled[peer].tryInsert(seqNum); // before it leaves inFlight, see isInFlight()
+        auto done = [this, peer, seqNum, then]()
+        {
+            inFlight[peer].erase(seqNum);
+            then();
+        };
+        if(wal == nullptr)
+        {
+            done();
+            return;
+        }
+        wal->whenDurable(wal->append(WriteAheadLog::WAL_HANDLED, peer, 0, seqNum), done);
+    }
+
+    // the request claimed by tryClaim() could not be handled durably, give the claim up without recording it as handled,
+    // so a retransmitted copy of it can be claimed and handled again
+    void releaseClaim(int peer, int64_t seqNum)
+    {
+        inFlight[peer].erase(seqNum);
+    }
+
+    // true while the sequence number is claimed and its handled record is not on disk yet,
+    // a sequence number neither claimable nor in flight is handled durably, and can be ack-ed again
+    bool isInFlight(int peer, int64_t seqNum)
+    {
+        return inFlight[peer].find(seqNum);
+    }
+
+    // check if the sequence has been handled
+    bool checkAlreadyHandled(int peer, int64_t seqNum)
+    {
+        return seq_handled[peer].contains(seqNum);
     }
 
     void addSentMessage(unsigned seqNum, const UGoPickup & toWorldPickupReq)
     {
-        seq_sent.insert(seqNum, TO_WORLD_PICKUP_REQ);
-        toWorldPickupReqs.insert(seqNum, { getCurrentSecond(), toWorldPickupReq });
+        registerSentMessage(seqNum, TO_WORLD_PICKUP_REQ, toWorldPickupReq);
     }
 
     void addSentMessage(unsigned seqNum, const UGoDeliver & toWorldDeliverReq)
     {
-        seq_sent.insert(seqNum, TO_WORLD_DELIVER_REQ);
-        toWorldDeliverReqs.insert(seqNum, { getCurrentSecond(), toWorldDeliverReq });
+        registerSentMessage(seqNum, TO_WORLD_DELIVER_REQ, toWorldDeliverReq);
     }
 
     void addSentMessage(unsigned seqNum, const UtoALoadRequest & toAmazonLoadReq)
     {
-        seq_sent.insert(seqNum, TO_AMAZON_LOAD_REQ);
-        toAmazonLoadReqs.insert(seqNum, { getCurrentSecond(), toAmazonLoadReq });
+        registerSentMessage(seqNum, TO_AMAZON_LOAD_REQ, toAmazonLoadReq);
     }
 
     void addSentMessage(unsigned seqNum, const Delivery & toAmazonDelivery)
     {
-        seq_sent.insert(seqNum, TO_AMAZON_DELIVERY);
-        toAmazonDeliveries.insert(seqNum, { getCurrentSecond(), toAmazonDelivery });
+        registerSentMessage(seqNum, TO_AMAZON_DELIVERY, toAmazonDelivery);
     }
 
     void addSentMessage(unsigned seqNum, const UserValidationResponse & toAmazonUserValidationRes)
     {
-        seq_sent.insert(seqNum, TO_AMAZON_USER_VALID);
-        toAmazonUserValidationReses.insert(seqNum, { getCurrentSecond(), toAmazonUserValidationRes });
+        registerSentMessage(seqNum, TO_AMAZON_USER_VALID, toAmazonUserValidationRes);
     }
 
     void addSentMessage(unsigned seqNum, const UQuery & toWorldQueryReq)
     {
-        seq_sent.insert(seqNum, TO_WORLD_QUERY_REQ);
-        toWorldQueryReqs.insert(seqNum, { getCurrentSecond(), toWorldQueryReq });
+        registerSentMessage(seqNum, TO_WORLD_QUERY_REQ, toWorldQueryReq);
     }
 
+    // resend every message whose timer has expired within the budget of its peer, and re-arm them
+    // the commands are spliced together from the stored bytes, nothing is copied into a protobuf message or re-encoded
     void resendMessage(Socket * worldSocket, Socket * amazonSocket)
     {
-        // Embarassingly Parallelism
-        int cur_second = getCurrentSecond();
-        std::thread amazonResendThread(&SequenceGenerator::resendAmazonMessage, this, amazonSocket, cur_second);
-        amazonResendThread.detach();
-        std::thread worldResendThread(&SequenceGenerator::resendWorldMessage, this, worldSocket, cur_second);
-        worldResendThread.detach();
+        for(int peer = 0; peer < PEER_NUM; ++peer)
+        {
+            std::vector<unsigned> expired = retransmitTimers[peer].advance();
+            if(expired.empty())
+            {
+                continue;
+            }
+            std::vector<std::pair<unsigned, OutstandingTable::Entry>> candidates;
+            candidates.reserve(expired.size());
+            for(unsigned seqNum : expired)
+            {
+                OutstandingTable::Entry entry;
+                if(outstanding[peer].find(seqNum, entry)) // or ack-ed meanwhile
+                {
+                    candidates.emplace_back(seqNum, std::move(entry));
+                }
+            }
+            std::sort(candidates.begin(), candidates.end(), [](const std::pair<unsigned, OutstandingTable::Entry> & lhs, const std::pair<unsigned, OutstandingTable::Entry> & rhs)
+            {
+                return lhs.second.sentTime < rhs.second.sentTime;
+            });
+
+            Socket * socket = peer == WORLD_PEER ? worldSocket : amazonSocket;
+            std::string command; // serialized UCommands or UtoACommand
+            std::string seqNums;
+            size_t idx = 0;
+            for(; idx < candidates.size(); ++idx)
+            {
+                unsigned seqNum = candidates[idx].first;
+                size_t payloadSize = candidates[idx].second.payload->size();
+                if(!resendBudget[peer].canConsume(payloadSize))
+                {
+                    break; // out of budget, keep the order for the next cycle
+                }
+                unsigned rtoMs = rtt[peer].getRto(candidates[idx].second.retries + 1);
+                OutstandingTable::Entry entry;
+                if(!outstanding[peer].retry(seqNum, rtoMs, entry)) // ack-ed since the candidates were collected
+                {
+                    continue;
+                }
+                resendBudget[peer].consume(payloadSize); // only this thread takes tokens, they're still there
+                if(!command.empty() && command.size() + entry.payload->size() > RESEND_FRAME_BYTES)
+                {
+                    sendResendFrame(peer, socket, command, seqNums);
+                }
+                DataGenerator::getInstance()->appendEncodedField(command, getFieldNumber(entry.kind), *entry.payload);
+                seqNums += " " + std::to_string(seqNum);
+                retransmitTimers[peer].schedule(seqNum, rtoMs);
+            }
+            sendResendFrame(peer, socket, command, seqNums);
+            for(; idx < candidates.size(); ++idx)
+            {
+                if(outstanding[peer].postpone(candidates[idx].first, RESEND_DEFER_MS)) // or ack-ed meanwhile
+                {
+                    retransmitTimers[peer].schedule(candidates[idx].first, RESEND_DEFER_MS);
+                }
+            }
+        }
     }
 
 private:
     // type of message
-    enum
+    enum : unsigned
     {
         TO_WORLD_PICKUP_REQ = 0,
         TO_WORLD_DELIVER_REQ = 1,
@@ -237,18 +460,19 @@ private:
         TO_AMAZON_USER_VALID = 5,
     };
 
-    // sequence number related variable
-    std::atomic<unsigned> seq;
-    ThreadsafeUnorderedMap<unsigned, unsigned> seq_sent;
-    ThreadsafeUnorderedMap<unsigned, unsigned> seq_handled;
-
-    // sent message related container
-    ThreadsafeUnorderedMap<unsigned, UGoPickup_with_time> toWorldPickupReqs;
-    ThreadsafeUnorderedMap<unsigned, UGoDeliver_with_time> toWorldDeliverReqs;
-    ThreadsafeUnorderedMap<unsigned, UQuery_with_time> toWorldQueryReqs;
-    ThreadsafeUnorderedMap<unsigned, UtoALoadRequest_with_time> toAmazonLoadReqs;
-    ThreadsafeUnorderedMap<unsigned, Delivery_with_time> toAmazonDeliveries;
-    ThreadsafeUnorderedMap<unsigned, UserValidationResponse_with_time> toAmazonUserValidationReses;
+
+    // sequence number related variable, world and Amazon number their messages independently
+    std::atomic<unsigned> seq[PEER_NUM];
+    DedupWindow seq_handled[PEER_NUM]; // sequence numbers received and handled, recorded in the log
+    ShardedUnorderedMap<int64_t, bool> inFlight[PEER_NUM]; // sequence numbers claimed, not handled durably yet
+
+    // un-acknowledged sent messages, their retransmission deadlines, and round trip estimation of each peer
+    OutstandingTable outstanding[PEER_NUM];
+    TimerWheel retransmitTimers[PEER_NUM];
+    RttEstimator rtt[PEER_NUM];
+    TokenBucket resendBudget[PEER_NUM]; // bytes per second resent to each peer
+    int64_t worldid; // world the state of WORLD_PEER belongs to, -1 if none, only set before the handlers start
+    WriteAheadLog * wal; // every change of the state above is logged, none if nullptr
 };
 
 #endif
\ No newline at end of file
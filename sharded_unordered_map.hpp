@@ -0,0 +1,245 @@
+#ifndef SHARDED_UNORDERED_MAP_HPP__
+#define SHARDED_UNORDERED_MAP_HPP__
+
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <pthread.h>
+#include <unordered_map>
+#define SHARDED_MAP_SHARD_NUM 64
+
+// reader/writer lock, std::shared_mutex is C++17
+class RWLock
+{
+public:
+    RWLock() { pthread_rwlock_init(&rwlock, NULL); }
+
+    RWLock(const RWLock &) = delete;
+    RWLock & operator=(const RWLock &) = delete;
+
+    void lock() { pthread_rwlock_wrlock(&rwlock); }
+
+    void unlock() { pthread_rwlock_unlock(&rwlock); }
+
+    void lock_shared() { pthread_rwlock_rdlock(&rwlock); }
+
+    void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+
+    ~RWLock() noexcept { pthread_rwlock_destroy(&rwlock); }
+
+private:
+    pthread_rwlock_t rwlock;
+};
+
+// std::shared_lock is C++14
+class SharedLock
+{
+public:
+    explicit SharedLock(RWLock & _rwlock) : rwlock(_rwlock) { rwlock.lock_shared(); }
+
+    SharedLock(const SharedLock &) = delete;
+    SharedLock & operator=(const SharedLock &) = delete;
+
+    ~SharedLock() noexcept { rwlock.unlock_shared(); }
+
+private:
+    RWLock & rwlock;
+};
+
+// drop-in replacement of ThreadsafeUnorderedMap, keys are spread over SHARDED_MAP_SHARD_NUM shards,
+// each with its own reader/writer lock, so operations on different shards never contend and lookups share a shard
+// unlike ThreadsafeUnorderedMap::get(), a missing key is never inserted
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ShardedUnorderedMap
+{
+private:
+    struct Shard
+    {
+        RWLock rwlock;
+        std::unordered_map<Key, Value, Hash> map;
+    };
+
+    size_t getShardIdx(const Key & k) const { return hash(k) % SHARDED_MAP_SHARD_NUM; }
+
+    Shard & getShard(const Key & k) { return shards[getShardIdx(k)]; }
+
+public:
+    ShardedUnorderedMap() = default;
+    ShardedUnorderedMap(const ShardedUnorderedMap &) = delete;
+    ShardedUnorderedMap & operator=(const ShardedUnorderedMap &) = delete;
+
+    bool find(const Key & k)
+    {
+        Shard & shard = getShard(k);
+        SharedLock lck(shard.rwlock);
+        return shard.map.find(k) != shard.map.end();
+    }
+
+    // copy the value of k, false if k is missing
+    bool find(const Key & k, Value & v)
+    {
+        Shard & shard = getShard(k);
+        SharedLock lck(shard.rwlock);
+        auto it = shard.map.find(k);
+        if(it == shard.map.end())
+        {
+            return false;
+        }
+        v = it->second;
+        return true;
+    }
+
+    void insert(const Key & k, const Value & v)
+    {
+        Shard & shard = getShard(k);
+        std::unique_lock<RWLock> lck(shard.rwlock);
+        shard.map[k] = v;
+    }
+
+    // value of k, a default one if k is missing
+    Value get(const Key & k)
+    {
+        Value v = Value();
+        find(k, v);
+        return v;
+    }
+
+    void erase(const Key & k)
+    {
+        Shard & shard = getShard(k);
+        std::unique_lock<RWLock> lck(shard.rwlock);
+        shard.map.erase(k);
+    }
+
+    // insert v unless k exists, return the value of k and whether v was inserted
+    std::pair<Value, bool> find_or_insert(const Key & k, const Value & v)
+    {
+        Shard & shard = getShard(k);
+        std::unique_lock<RWLock> lck(shard.rwlock);
+        auto res = shard.map.insert(std::make_pair(k, v));
+        return std::make_pair(res.first->second, res.second);
+    }
+
+    // erase k if pred(value) holds, pred may move the value out, return whether k was erased
+    template<typename Pred>
+    bool erase_if(const Key & k, Pred pred)
+    {
+        Shard & shard = getShard(k);
+        std::unique_lock<RWLock> lck(shard.rwlock);
+        auto it = shard.map.find(k);
+        if(it == shard.map.end() || !pred(it->second))
+        {
+            return false;
+        }
+        shard.map.erase(it);
+        return true;
+    }
+
+    // call fn(value) on the value of k under the lock of its shard, fn may modify it, false if k is missing
+    template<typename Fn>
+    bool visit(const Key & k, Fn fn)
+    {
+        Shard & shard = getShard(k);
+        std::unique_lock<RWLock> lck(shard.rwlock);
+        auto it = shard.map.find(k);
+        if(it == shard.map.end())
+        {
+            return false;
+        }
+        fn(it->second);
+        return true;
+    }
+
+    // erase every key of keys, sorted by shard so each shard is locked once, fn(value) is called on every erased value
+    template<typename Fn>
+    void erase_all(std::vector<Key> & keys, Fn fn)
+    {
+        std::sort(keys.begin(), keys.end(), [this](const Key & lhs, const Key & rhs)
+        {
+            return getShardIdx(lhs) < getShardIdx(rhs);
+        });
+        size_t idx = 0;
+        while(idx < keys.size())
+        {
+            size_t shardIdx = getShardIdx(keys[idx]);
+            Shard & shard = shards[shardIdx];
+            std::unique_lock<RWLock> lck(shard.rwlock);
+            for(; idx < keys.size() && getShardIdx(keys[idx]) == shardIdx; ++idx)
+            {
+                auto it = shard.map.find(keys[idx]);
+                if(it != shard.map.end())
+                {
+                    fn(it->second);
+                    shard.map.erase(it);
+                }
+            }
+        }
+    }
+
+    // call fn(key, value) on every entry for which pred(key, value) holds, nothing is copied
+    // shards are walked one by one under a shared lock, writers only wait for the shard being walked
+    // entries inserted or erased meanwhile in other shards may or may not be seen
+    template<typename Pred, typename Fn>
+    void for_each_if(Pred pred, Fn fn)
+    {
+        for(Shard & shard : shards)
+        {
+            SharedLock lck(shard.rwlock);
+            for(const auto & p : shard.map)
+            {
+                if(pred(p.first, p.second))
+                {
+                    fn(p.first, p.second);
+                }
+            }
+        }
+    }
+
+    std::vector<Key> getAllKey()
+    {
+        std::vector<Key> res;
+        for(Shard & shard : shards)
+        {
+            SharedLock lck(shard.rwlock);
+            for(const auto & p : shard.map)
+            {
+                res.push_back(p.first);
+            }
+        }
+        return res;
+    }
+
+    std::vector<Value> getAllValue()
+    {
+        std::vector<Value> res;
+        for(Shard & shard : shards)
+        {
+            SharedLock lck(shard.rwlock);
+            for(const auto & p : shard.map)
+            {
+                res.push_back(p.second);
+            }
+        }
+        return res;
+    }
+
+    size_t size()
+    {
+        size_t cnt = 0;
+        for(Shard & shard : shards)
+        {
+            SharedLock lck(shard.rwlock);
+            cnt += shard.map.size();
+        }
+        return cnt;
+    }
+
+private:
+    Hash hash;
+    Shard shards[SHARDED_MAP_SHARD_NUM];
+};
+
+#endif
@@ -1,21 +1,158 @@
 #ifndef SOCKET_HPP__
 #define SOCKET_HPP__
 
+#include <deque>
 #include <mutex>
+#include <string>
+#include <vector>
+#include <cerrno>
 #include <netdb.h>
 #include <cstring>
 #include <cstdlib>
+#include <fcntl.h>
 #include <unistd.h>
 #include <iostream>
+#include <functional>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <google/protobuf/io/coded_stream.h>
-#include <google/protobuf/io/zero_copy_stream_impl.h>
+#define RECV_CHUNK_SIZE 65536
+#define MAX_FRAME_SIZE (64 * 1024 * 1024)
 
+// every message on the wire is a varint32 length followed by the serialized protobuf
+// before attached to a Reactor, the socket is blocking: sendMsg() writes through and recvMsg() waits for one frame
+// after attached, sendMsg() only queues the frame, and the reactor thread reads/writes the non-blocking fd
 class Socket
 {
+private:
+    // read whatever is available into the receive buffer, false on error or peer closed
+    bool readSome()
+    {
+        while(true)
+        {
+            ssize_t len = recv(fd, recvChunk, sizeof(recvChunk), 0);
+            if(len > 0)
+            {
+                inbuf.append(recvChunk, len);
+                return true;
+            }
+            if(len < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+    }
+
+    // cut one complete frame from the receive buffer
+    // return false if the frame is not complete yet, set malformed if the length prefix is invalid
+    bool extractFrame(std::string & frame)
+    {
+        uint32_t size = 0;
+        size_t pos = inpos;
+        for(int shift = 0; ; shift += 7)
+        {
+            if(shift > 28)
+            {
+                malformed = true;
+                return false;
+            }
+            if(pos >= inbuf.size())
+            {
+                return false;
+            }
+            uint8_t byte = inbuf[pos++];
+            size |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if(!(byte & 0x80))
+            {
+                break;
+            }
+        }
+        if(size > MAX_FRAME_SIZE)
+        {
+            malformed = true;
+            return false;
+        }
+        if(inbuf.size() - pos < size)
+        {
+            return false;
+        }
+        frame.assign(inbuf, pos, size);
+        inpos = pos + size;
+        return true;
+    }
+
+    // drop consumed bytes from the front of the receive buffer
+    void compactInbuf()
+    {
+        inbuf.erase(0, inpos);
+        inpos = 0;
+    }
+
+    // write frames until the queue is empty or the kernel buffer is full, false on error
+    bool writePending()
+    {
+        while(true)
+        {
+            if(writing.empty())
+            {
+                std::unique_lock<std::mutex> lck(out_mtx);
+                if(!pending.empty())
+                {
+                    writing.swap(pending);
+                }
+                else if(!pendingLow.empty())
+                {
+                    // one frame at a time, fresh frames queued meanwhile go first
+                    writing.push_back(std::move(pendingLow.front()));
+                    pendingLow.pop_front();
+                }
+                else
+                {
+                    return true;
+                }
+            }
+            while(!writing.empty())
+            {
+                const std::string & frame = writing.front();
+                ssize_t len = send(fd, frame.data() + outpos, frame.size() - outpos, MSG_NOSIGNAL);
+                if(len < 0)
+                {
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return errno == EAGAIN || errno == EWOULDBLOCK;
+                }
+                outpos += len;
+                if(outpos == frame.size())
+                {
+                    writing.pop_front();
+                    outpos = 0;
+                }
+            }
+        }
+    }
+
+    bool enqueueFrame(std::string frame, bool lowPriority = false)
+    {
+        std::function<void()> notify;
+        {
+            std::unique_lock<std::mutex> lck(out_mtx);
+            (lowPriority ? pendingLow : pending).push_back(std::move(frame));
+            notify = notifyWritable;
+        }
+        if(notify)
+        {
+            notify();
+            return true;
+        }
+        std::unique_lock<std::mutex> lck(send_mtx);
+        return writePending();
+    }
+
 public:
     Socket(const char * hostname, const char * port)
     {
@@ -57,67 +194,107 @@ public:
         // free address infor list
         freeaddrinfo(host_info_list);
 
-        // initialize Google Protocal Buffer input/output
-        out = new google::protobuf::io::FileOutputStream(fd);
-        in = new google::protobuf::io::FileInputStream(fd);
+        inpos = 0;
+        outpos = 0;
+        malformed = false;
     }
 
+    // adopt an already connected stream socket, like one end of a socketpair
+    explicit Socket(int _fd) :
+        fd { _fd },
+        inpos { 0 },
+        malformed { false },
+        outpos { 0 }
+        {}
+
+    Socket(const Socket &) = delete;
+    Socket & operator=(const Socket &) = delete;
+
+    int getFd() const { return fd; }
+
     template<typename T>
     bool sendMsg(const T & message) 
     {
-        std::unique_lock<std::mutex> lck(send_mtx);
-        { 
-            // extra scope: make output go away before out->Flush()
-            // We create a new coded stream for each message.
-            // Don’t worry, this is fast.
-            google::protobuf::io::CodedOutputStream output(out);
-            // Write the size.
-            const int size = message.ByteSizeLong();
-            output.WriteVarint32(size);
-            uint8_t * buffer = output.GetDirectBufferForNBytesAndAdvance(size);
-            if (buffer != NULL) 
-            {
-                // Optimization: The message fits in one buffer, so use the faster direct-to-array serialization path.
-                message.SerializeWithCachedSizesToArray(buffer);
-            } 
-            else 
-            {
-                // Slightly-slower path when the message is multiple buffers.
-                message.SerializeWithCachedSizes(&output);
-                if (output.HadError()) 
-                {
-                    return false;
-                }
-            }
-        }
-        out->Flush();
-        return true;
+        // Write the size, then the message, into one frame
+        const uint32_t size = message.ByteSizeLong();
+        std::string frame(google::protobuf::io::CodedOutputStream::VarintSize32(size) + size, '\0');
+        uint8_t * buffer = reinterpret_cast<uint8_t *>(&frame[0]);
+        buffer = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(size, buffer);
+        message.SerializeWithCachedSizesToArray(buffer);
+        return enqueueFrame(std::move(frame));
     }
 
+    // send an already serialized message as one frame
+    // a low priority frame(resend) is only written when no other frame is queued
+    bool sendFrame(const std::string & body, bool lowPriority = false)
+    {
+        const uint32_t size = body.size();
+        std::string frame(google::protobuf::io::CodedOutputStream::VarintSize32(size) + size, '\0');
+        uint8_t * buffer = reinterpret_cast<uint8_t *>(&frame[0]);
+        buffer = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(size, buffer);
+        memcpy(buffer, body.data(), size);
+        return enqueueFrame(std::move(frame), lowPriority);
+    }
+
+    // blocking receive, only used before the socket is attached to a Reactor
     template<typename T>
     bool recvMsg(T & message)
     {
         std::unique_lock<std::mutex> lck(recv_mtx);
-        google::protobuf::io::CodedInputStream input(in);
-        uint32_t size;
-        if (!input.ReadVarint32(&size)) 
+        std::string frame;
+        while(!extractFrame(frame))
         {
-            return false;
+            if(malformed || !readSome())
+            {
+                return false;
+            }
         }
-        // Tell the stream not to read beyond that size.
-        google::protobuf::io::CodedInputStream::Limit limit = input.PushLimit(size);
-        // Parse the message.
-        if (!message.MergeFromCodedStream(&input)) 
+        return message.ParseFromString(frame);
+    }
+
+    // switch to non-blocking mode, notify is called whenever a frame is queued
+    void attach(std::function<void()> notify)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        std::unique_lock<std::mutex> lck(out_mtx);
+        notifyWritable = notify;
+    }
+
+    // called from the reactor thread when readable, collect every complete frame
+    // return false on error, peer closed or malformed frame
+    bool readFrames(std::vector<std::string> & frames)
+    {
+        std::unique_lock<std::mutex> lck(recv_mtx);
+        bool alive = true;
+        while(true)
         {
-            return false;
+            ssize_t len = recv(fd, recvChunk, sizeof(recvChunk), 0);
+            if(len > 0)
+            {
+                inbuf.append(recvChunk, len);
+                continue;
+            }
+            if(len < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            alive = len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
         }
-        if (!input.ConsumedEntireMessage()) 
+        std::string frame;
+        while(extractFrame(frame))
         {
-            return false;
+            frames.push_back(std::move(frame));
         }
-        // Release the limit.
-        input.PopLimit(limit);
-        return true;
+        compactInbuf();
+        return alive && !malformed;
+    }
+
+    // called from the reactor thread when writable or a frame is queued, false on error
+    bool flushFrames()
+    {
+        std::unique_lock<std::mutex> lck(send_mtx);
+        return writePending();
     }
 
     ~Socket() noexcept
@@ -129,8 +306,16 @@ private:
     int fd;
     std::mutex recv_mtx;
     std::mutex send_mtx;
-    google::protobuf::io::FileOutputStream * out; // send
-    google::protobuf::io::FileInputStream * in; // receive
+    std::mutex out_mtx;
+    std::string inbuf; // received bytes, frames are cut from inpos
+    size_t inpos;
+    bool malformed;
+    std::deque<std::string> pending; // frames queued by sender threads
+    std::deque<std::string> pendingLow; // low priority frames queued by sender threads
+    std::deque<std::string> writing; // frames owned by the writer, front one partially sent up to outpos
+    size_t outpos;
+    std::function<void()> notifyWritable;
+    char recvChunk[RECV_CHUNK_SIZE];
 };
 
 #endif
\ No newline at end of file
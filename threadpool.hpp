@@ -0,0 +1,109 @@
+#ifndef THREADPOOL_HPP__
+#define THREADPOOL_HPP__
+
+#include <mutex>
+#include <queue>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+#define THREAD_POOL_SIZE 8
+#define THREAD_POOL_CAPACITY 4096
+
+// fixed-size executor, handlers are submitted as tasks instead of detaching one thread per message
+// at most capacity tasks wait for a worker, submit() blocks while the queue is full, so a peer flooding us
+// stalls the reactor reading its socket(backpressure through tcp) instead of growing the queue without bound
+// a task must not submit to its own pool, all workers blocked on a full queue would never drain it
+class ThreadPool
+{
+private:
+    void workerLoop()
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                cv.wait(lck, [&](){ return stopped || !tasks.empty(); });
+                if(stopped && tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front()); tasks.pop();
+                ++busyWorkers;
+            }
+            notFull.notify_one();
+            task();
+            --busyWorkers;
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned workerCnt = THREAD_POOL_SIZE, size_t _capacity = THREAD_POOL_CAPACITY) :
+        capacity { _capacity > 0 ? _capacity : 1 },
+        stopped { false },
+        busyWorkers { 0 }
+    {
+        if(workerCnt == 0)
+        {
+            workerCnt = 1;
+        }
+        for(unsigned idx = 0; idx < workerCnt; ++idx)
+        {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            notFull.wait(lck, [this](){ return tasks.size() < capacity; });
+            tasks.push(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+    unsigned getWorkerCount() const { return workers.size(); }
+
+    // tasks waiting for a free worker
+    unsigned getQueueDepth()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        return tasks.size();
+    }
+
+    // workers currently running a task
+    unsigned getBusyWorkerCount() const { return busyWorkers; }
+
+    // drain queued tasks, then join all workers
+    ~ThreadPool() noexcept
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            stopped = true;
+        }
+        cv.notify_all();
+        for(auto & worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+private:
+    const size_t capacity;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable notFull; // a task left the queue
+    bool stopped;
+    std::atomic<unsigned> busyWorkers;
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+};
+
+#endif
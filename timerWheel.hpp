@@ -0,0 +1,164 @@
+#ifndef TIMER_WHEEL_HPP__
+#define TIMER_WHEEL_HPP__
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#define TIMER_WHEEL_TICK_MS 1
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+// hierarchical timing wheel on the monotonic clock, timers are identified by an unsigned id (sequence number)
+// level 0 has one slot per tick, every upper level slot spans a full turn of the level below,
+// timers are cascaded down when a lower level wraps around
+// 4 levels of 64 slots with 1ms tick cover about 4.6 hours, anything later is parked in the last slot
+class TimerWheel
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Timer
+    {
+        unsigned id;
+        uint64_t expireTick;
+    };
+
+    struct Position
+    {
+        int level;
+        int slot;
+        std::list<Timer>::iterator it;
+    };
+
+    uint64_t getTick(Clock::time_point time) const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time - start).count() / tickMs;
+    }
+
+    void place(const Timer & timer)
+    {
+        uint64_t delta = timer.expireTick - currentTick;
+        int level = 0;
+        while(level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * (level + 1))))
+        {
+            ++level;
+        }
+        uint64_t tick = timer.expireTick;
+        if(delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)))
+        {
+            tick = currentTick + (1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1; // beyond range, re-placed on cascade
+        }
+        int slot = (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+        std::list<Timer> & bucket = slots[level][slot];
+        bucket.push_front(timer);
+        positions[timer.id] = Position { level, slot, bucket.begin() };
+    }
+
+    // move every timer of the current upper level slot one level down
+    void cascade(int level)
+    {
+        int slot = (currentTick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+        std::list<Timer> bucket;
+        bucket.swap(slots[level][slot]);
+        for(const Timer & timer : bucket)
+        {
+            place(timer);
+        }
+    }
+
+public:
+    explicit TimerWheel(unsigned _tickMs = TIMER_WHEEL_TICK_MS) :
+        tickMs { _tickMs == 0 ? 1 : _tickMs },
+        start { Clock::now() },
+        currentTick { 0 }
+        {}
+
+    // arm (or re-arm) timer id to expire delayMs milliseconds from now
+    void schedule(unsigned id, unsigned delayMs)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        eraseLocked(id);
+        uint64_t expireTick = getTick(Clock::now() + std::chrono::milliseconds(delayMs));
+        place(Timer { id, expireTick > currentTick ? expireTick : currentTick + 1 });
+    }
+
+    void cancel(unsigned id)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        eraseLocked(id);
+    }
+
+    void cancel(const std::vector<unsigned> & ids)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        for(unsigned id : ids)
+        {
+            eraseLocked(id);
+        }
+    }
+
+    // move the wheel up to now, return ids of every expired timer
+    std::vector<unsigned> advance()
+    {
+        std::vector<unsigned> expired;
+        std::unique_lock<std::mutex> lck(mtx);
+        uint64_t nowTick = getTick(Clock::now());
+        if(positions.empty())
+        {
+            currentTick = nowTick > currentTick ? nowTick : currentTick;
+            return expired;
+        }
+        while(currentTick < nowTick)
+        {
+            ++currentTick;
+            for(int level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+            {
+                if(currentTick & ((1ULL << (TIMER_WHEEL_SLOT_BITS * level)) - 1))
+                {
+                    break;
+                }
+                cascade(level);
+            }
+            std::list<Timer> & bucket = slots[0][currentTick & (TIMER_WHEEL_SLOTS - 1)];
+            for(const Timer & timer : bucket)
+            {
+                expired.push_back(timer.id);
+                positions.erase(timer.id);
+            }
+            bucket.clear();
+        }
+        return expired;
+    }
+
+    size_t size()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        return positions.size();
+    }
+
+private:
+    void eraseLocked(unsigned id)
+    {
+        auto pos = positions.find(id);
+        if(pos == positions.end())
+        {
+            return;
+        }
+        slots[pos->second.level][pos->second.slot].erase(pos->second.it);
+        positions.erase(pos);
+    }
+
+private:
+    std::mutex mtx;
+    const unsigned tickMs;
+    const Clock::time_point start;
+    uint64_t currentTick; // every tick up to this one has been processed
+    std::list<Timer> slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    std::unordered_map<unsigned, Position> positions; // id to its slot, for O(1) cancel
+};
+
+#endif
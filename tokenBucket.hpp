@@ -0,0 +1,73 @@
+#ifndef TOKEN_BUCKET_HPP__
+#define TOKEN_BUCKET_HPP__
+
+#include <mutex>
+#include <chrono>
+#include <cstddef>
+#include <algorithm>
+#define TOKEN_BUCKET_RATE (1024 * 1024)
+#define TOKEN_BUCKET_BURST (256 * 1024)
+
+// rate limiter, tokens(bytes) are refilled at rate per second up to burst
+// a request larger than burst passes once the bucket is full and leaves it in debt, so it's never starved
+class TokenBucket
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void refill()
+    {
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - last).count();
+        tokens = std::min(tokens + elapsed * rate, static_cast<double>(burst));
+        last = now;
+    }
+
+public:
+    explicit TokenBucket(size_t _rate = TOKEN_BUCKET_RATE, size_t _burst = TOKEN_BUCKET_BURST) :
+        rate { static_cast<double>(_rate) },
+        burst { _burst },
+        tokens { static_cast<double>(_burst) },
+        last { Clock::now() }
+        {}
+
+    TokenBucket(const TokenBucket &) = delete;
+    TokenBucket & operator=(const TokenBucket &) = delete;
+
+    // take cnt tokens if available, false if the caller has to wait
+    bool tryConsume(size_t cnt)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        refill();
+        if(tokens < static_cast<double>(std::min(cnt, burst)))
+        {
+            return false;
+        }
+        tokens -= cnt;
+        return true;
+    }
+
+    // true if cnt tokens are available, none is taken
+    bool canConsume(size_t cnt)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        refill();
+        return tokens >= static_cast<double>(std::min(cnt, burst));
+    }
+
+    // take cnt tokens, checked by canConsume() first, the bucket may go into debt
+    void consume(size_t cnt)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        tokens -= cnt;
+    }
+
+private:
+    std::mutex mtx;
+    const double rate; // tokens per second
+    const size_t burst;
+    double tokens;
+    Clock::time_point last; // last refill
+};
+
+#endif
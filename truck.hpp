@@ -1,9 +1,9 @@
 #ifndef TRUCK_HPP__
 #define TRUCK_HPP__
 
-#include <mutex>
 #include <vector>
 
+// a truck is only touched from its own lane of the truck KeyedExecutor, so it needs no lock
 class Truck
 {
 public:
@@ -36,14 +36,9 @@ public:
 
     const std::vector<int> & getPackages() { return packages; }
 
-    void addPackage(int packageid) 
-    { 
-        std::unique_lock<std::mutex> lck(mtx);
-        packages.push_back(packageid); 
-    }
+    void addPackage(int packageid) { packages.push_back(packageid); }
 
 private:
-    std::mutex mtx;
     const int init_x;
     const int init_y;
     int warehouseid;
@@ -6,8 +6,9 @@
 #include <queue>
 #include <vector>
 #include <string>
+#include <utility>
+#include <functional>
 #include <unordered_map>
-#include <condition_variable>
 #define TRUCK_NUM 1024
 
 class TruckPool
@@ -18,7 +19,7 @@ private:
         for(int idx = 0; idx < TRUCK_NUM; ++idx)
         {
             trucks.emplace_back(0, 0);
-            availableTrucks.push(idx++);
+            availableTrucks.push(idx);
         }
     }
 
@@ -41,41 +42,97 @@ public:
     const std::vector<int> getPackages(int truckid) { return trucks[truckid].getPackages(); }
 
     // (1) check if there's truck to the target warehouse
-    // (2) if not, wait until there's free truck available
-    int getFreeTruck(int warehouseid)
+    // (2) if not, take a free truck and mark it on the way to the warehouse
+    // (3) if no truck is free, queue the request, returnTruck() assigns the next returned truck to it
+    // onTruck(truckid) is called without the lock, at once or from returnTruck(), the caller never waits for a truck
+    void requestTruck(int warehouseid, std::function<void(int)> onTruck)
+    {
+        int truckid;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            auto it = truckToWarehouse.find(warehouseid);
+            if(it != truckToWarehouse.end())
+            {
+                truckid = it->second;
+            }
+            else if(!availableTrucks.empty())
+            {
+                truckid = availableTrucks.front(); availableTrucks.pop();
+                truckToWarehouse[warehouseid] = truckid;
+            }
+            else
+            {
+                // every request of a warehouse is served by the same truck, warehouses are served in arrival order
+                std::vector<std::function<void(int)>> & waiting = waitingRequests[warehouseid];
+                if(waiting.empty())
+                {
+                    waitingWarehouses.push(warehouseid);
+                }
+                waiting.push_back(std::move(onTruck));
+                return;
+            }
+        }
+        onTruck(truckid);
+    }
+
+    // requests queued for a free truck
+    unsigned getWaitingCount()
     {
         std::unique_lock<std::mutex> lck(mtx);
-        if(truckToWarehouse.find(warehouseid) != truckToWarehouse.end())
+        unsigned waitingCnt = 0;
+        for(const auto & waiting : waitingRequests)
         {
-            return truckToWarehouse[warehouseid];
+            waitingCnt += waiting.second.size();
         }
-        cv.wait(lck, [&](){ return !availableTrucks.empty(); });
-        int truckid = availableTrucks.front(); availableTrucks.pop();
-        return truckid;
+        return waitingCnt;
     }
 
     // truck has departed to destinations, cannot be assigned
+    // called from the truck's own lane, which is the only writer of its warehouse id
     void registerTruck(int truckid)
     {
+        int warehouseid = getWarehouseid(truckid);
         std::unique_lock<std::mutex> lck(mtx);
-        truckToWarehouse.erase(getWarehouseid(truckid));
+        auto it = truckToWarehouse.find(warehouseid);
+        if(it != truckToWarehouse.end() && it->second == truckid)
+        {
+            truckToWarehouse.erase(it);
+        }
     }
 
-    // truck has finish delivery
+    // truck has finish delivery, sent to the warehouse waiting longest if any, or published as available
+    // called from the truck's own lane, so the truck can be reset before it's handed out
     void returnTruck(int truckid)
     {
-        std::unique_lock<std::mutex> lck(mtx);
         trucks[truckid].reset();
-        availableTrucks.push(truckid);
-        cv.notify_one();
+        std::vector<std::function<void(int)>> waiting;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            if(waitingWarehouses.empty())
+            {
+                availableTrucks.push(truckid);
+                return;
+            }
+            int warehouseid = waitingWarehouses.front(); waitingWarehouses.pop();
+            waiting.swap(waitingRequests[warehouseid]);
+            waitingRequests.erase(warehouseid);
+            truckToWarehouse[warehouseid] = truckid;
+        }
+        for(auto & onTruck : waiting)
+        {
+            onTruck(truckid);
+        }
     }
 
 private:
+    // only guards the shared free list, warehouse assignment and waiting requests,
+    // per-truck state is serialized by the truck KeyedExecutor
     std::mutex mtx;
-    std::condition_variable cv;
     std::vector<Truck> trucks;
     std::queue<int> availableTrucks; // trucks available, not on the way to warehouse or destination
     std::unordered_map<int, int> truckToWarehouse; // warehouse id as key, truck id as value(only trucks on the way to warehouse)
+    std::queue<int> waitingWarehouses; // warehouses waiting for a free truck, in arrival order(only while no truck is available)
+    std::unordered_map<int, std::vector<std::function<void(int)>>> waitingRequests; // warehouse id as key, requests waiting as value
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,450 @@
+#ifndef WRITE_AHEAD_LOG_HPP__
+#define WRITE_AHEAD_LOG_HPP__
+
+#include "logger.hpp"
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <sys/stat.h>
+#include <condition_variable>
+#define WAL_PATH "ups.wal"
+#define WAL_COMPACT_RECORDS 1000000
+#define WAL_HEADER_SIZE 20
+#define WAL_CHUNK_SIZE (1024 * 1024)
+
+// append-only log of the protocol state of SequenceGenerator, replayed on startup to survive a crash
+// record := length(4) crc32(4) type(1) peer(1) kind(1) reserved(1) seqNum(8) payload(length), in host byte order,
+// crc32 covers everything after itself; a torn or corrupt record ends the log and is cut off on recovery
+// records must be appended after the change they describe is made in memory, so a snapshot taken later always includes it
+// group commit: appenders only queue encoded records, one background thread writes whatever has queued up and
+// fdatasync() it once, then wakes every appender waiting for a record of that batch
+// compaction: the live state is written to a new file followed by the records appended meanwhile, then renamed over the log
+class WriteAheadLog
+{
+public:
+    // type of record
+    enum : uint8_t
+    {
+        WAL_SENT = 1, // message sent and not ack-ed yet, payload is the serialized message
+        WAL_ACK = 2,
+        WAL_HANDLED = 3, // received sequence number handled
+        WAL_WATERMARK = 4, // every received sequence number below seqNum handled
+        WAL_NEXT_SEQ = 5, // every sequence number below seqNum has been used
+        WAL_WORLD_ID = 6, // state of the peer from now on belongs to world seqNum
+    };
+
+    struct Record
+    {
+        uint8_t type;
+        uint8_t peer;
+        uint8_t kind;
+        int64_t seqNum;
+        std::string payload;
+    };
+
+private:
+    // crc32 (IEEE), continued over more data from a non-finalized crc
+    static uint32_t updateCrc(uint32_t crc, const char * data, size_t len)
+    {
+        static const uint32_t * table = buildCrcTable();
+        for(size_t idx = 0; idx < len; ++idx)
+        {
+            crc = table[(crc ^ static_cast<uint8_t>(data[idx])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    static uint32_t crc32(const char * data, size_t len) { return updateCrc(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF; }
+
+    static const uint32_t * buildCrcTable()
+    {
+        static uint32_t table[256];
+        for(uint32_t idx = 0; idx < 256; ++idx)
+        {
+            uint32_t crc = idx;
+            for(int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+            }
+            table[idx] = crc;
+        }
+        return table;
+    }
+
+    static void encode(std::string & out, uint8_t type, uint8_t peer, uint8_t kind, int64_t seqNum, const std::string & payload)
+    {
+        char header[WAL_HEADER_SIZE];
+        uint32_t len = payload.size();
+        memcpy(header, &len, 4);
+        header[8] = type;
+        header[9] = peer;
+        header[10] = kind;
+        header[11] = 0;
+        memcpy(header + 12, &seqNum, 8);
+        uint32_t crc = updateCrc(updateCrc(0xFFFFFFFF, header + 8, WAL_HEADER_SIZE - 8), payload.data(), payload.size()) ^ 0xFFFFFFFF;
+        memcpy(header + 4, &crc, 4);
+        out.append(header, WAL_HEADER_SIZE);
+        out.append(payload);
+    }
+
+    static bool writeAll(int fd, const std::string & data)
+    {
+        size_t pos = 0;
+        while(pos < data.size())
+        {
+            ssize_t len = write(fd, data.data() + pos, data.size() - pos);
+            if(len < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            pos += len;
+        }
+        return true;
+    }
+
+    // make the rename of the log durable
+    void syncDirectory()
+    {
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int dirfd = open(dir.c_str(), O_RDONLY);
+        if(dirfd != -1)
+        {
+            fsync(dirfd);
+            close(dirfd);
+        }
+    }
+
+    void fail(const char * what)
+    {
+        Logger::getInstance()->log("error.log", "write-ahead log ", what, " error: ", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // background thread, write and sync every queued record
+    void syncLoop()
+    {
+        std::string batch;
+        while(true)
+        {
+            uint64_t batchLsn = 0;
+            unsigned batchEpoch = 0;
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                cond.wait(lck, [this]() { return stopped || !buffer.empty(); });
+                if(buffer.empty())
+                {
+                    return; // stopped, everything written
+                }
+                batch.swap(buffer);
+                batchLsn = appendedLsn;
+                batchEpoch = epoch;
+            }
+            {
+                std::unique_lock<std::mutex> lck(io_mtx);
+                // taken before a compaction finished, the new file already holds these records or their effect
+                if(batchEpoch == epoch && (!writeAll(fd, batch) || fdatasync(fd) != 0))
+                {
+                    fail("write");
+                }
+            }
+            batch.clear();
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                durableLsn = std::max(durableLsn, batchLsn);
+            }
+            durableCond.notify_all();
+            runDurableCallbacks();
+        }
+    }
+
+    // call every callback whose record is on disk now, without the lock
+    void runDurableCallbacks()
+    {
+        std::vector<std::function<void()>> due;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            auto it = std::stable_partition(durableCallbacks.begin(), durableCallbacks.end(), [this](const std::pair<uint64_t, std::function<void()>> & callback)
+            {
+                return callback.first > durableLsn;
+            });
+            for(auto cur = it; cur != durableCallbacks.end(); ++cur)
+            {
+                due.push_back(std::move(cur->second));
+            }
+            durableCallbacks.erase(it, durableCallbacks.end());
+        }
+        for(auto & fn : due)
+        {
+            fn();
+        }
+    }
+
+public:
+    explicit WriteAheadLog(const char * _path = WAL_PATH) :
+        path { _path },
+        fd { open(_path, O_RDWR | O_CREAT | O_APPEND, 0644) },
+        appendedLsn { 0 },
+        durableLsn { 0 },
+        recordCnt { 0 },
+        epoch { 0 },
+        stopped { false },
+        compacting { false },
+        tmpFd { -1 },
+        snapshotCnt { 0 },
+        sideCnt { 0 }
+    {
+        if(fd == -1)
+        {
+            fail("open");
+        }
+        syncThread = std::thread(&WriteAheadLog::syncLoop, this);
+    }
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog & operator=(const WriteAheadLog &) = delete;
+
+    // read every intact record in order, call fn on each, return record count
+    // only called on startup before any append, a torn tail left by a crash is truncated
+    template<typename Fn>
+    size_t replay(Fn fn)
+    {
+        struct stat st;
+        if(fstat(fd, &st) != 0)
+        {
+            fail("stat");
+        }
+        std::string data(st.st_size, '\0');
+        size_t total = 0;
+        while(total < data.size())
+        {
+            ssize_t len = pread(fd, &data[total], data.size() - total, total);
+            if(len < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(len <= 0)
+            {
+                break;
+            }
+            total += len;
+        }
+        data.resize(total);
+
+        size_t pos = 0;
+        size_t cnt = 0;
+        Record record;
+        while(data.size() - pos >= WAL_HEADER_SIZE)
+        {
+            uint32_t len, crc;
+            memcpy(&len, &data[pos], 4);
+            memcpy(&crc, &data[pos + 4], 4);
+            if(data.size() - pos - WAL_HEADER_SIZE < len || crc32(&data[pos + 8], WAL_HEADER_SIZE - 8 + len) != crc)
+            {
+                break;
+            }
+            record.type = data[pos + 8];
+            record.peer = data[pos + 9];
+            record.kind = data[pos + 10];
+            memcpy(&record.seqNum, &data[pos + 12], 8);
+            record.payload.assign(data, pos + WAL_HEADER_SIZE, len);
+            fn(record);
+            ++cnt;
+            pos += WAL_HEADER_SIZE + len;
+        }
+        if(pos < data.size())
+        {
+            Logger::getInstance()->log("error.log", "write-ahead log: drop ", data.size() - pos, " bytes of torn tail");
+            if(ftruncate(fd, pos) != 0)
+            {
+                fail("truncate");
+            }
+        }
+        std::unique_lock<std::mutex> lck(mtx);
+        recordCnt = cnt;
+        return cnt;
+    }
+
+    // queue a record, return its log sequence number for waitDurable()
+    uint64_t append(uint8_t type, uint8_t peer, uint8_t kind, int64_t seqNum, const std::string & payload = std::string())
+    {
+        uint64_t lsn;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            size_t start = buffer.size();
+            encode(buffer, type, peer, kind, seqNum, payload);
+            if(compacting)
+            {
+                sideBuf.append(buffer, start, std::string::npos);
+                ++sideCnt;
+            }
+            lsn = ++appendedLsn;
+            ++recordCnt;
+        }
+        cond.notify_one();
+        return lsn;
+    }
+
+    // block until the record lsn, and every record before it, is on disk
+    void waitDurable(uint64_t lsn)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        durableCond.wait(lck, [this, lsn]() { return durableLsn >= lsn; });
+    }
+
+    // call fn once the record lsn, and every record before it, is on disk, without waiting for it
+    // fn is called by the thread syncing the log, or at once if the record is on disk already
+    void whenDurable(uint64_t lsn, std::function<void()> fn)
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            if(durableLsn < lsn)
+            {
+                durableCallbacks.emplace_back(lsn, std::move(fn));
+                return;
+            }
+        }
+        fn();
+    }
+
+    bool needsCompaction()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        return !compacting && recordCnt >= WAL_COMPACT_RECORDS;
+    }
+
+    // start writing a new log, false if a compaction is running already
+    // records appended from now on are kept for the new log, the snapshot covers everything before
+    bool beginCompaction()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        if(compacting)
+        {
+            return false;
+        }
+        tmpPath = path + ".compact";
+        tmpFd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if(tmpFd == -1)
+        {
+            Logger::getInstance()->log("error.log", "write-ahead log compaction error: ", strerror(errno));
+            return false;
+        }
+        compacting = true;
+        sideBuf.clear();
+        sideCnt = 0;
+        snapshotCnt = 0;
+        return true;
+    }
+
+    // add one record of the live state to the new log, only called by the compacting thread
+    void addSnapshotRecord(uint8_t type, uint8_t peer, uint8_t kind, int64_t seqNum, const std::string & payload = std::string())
+    {
+        encode(snapshot, type, peer, kind, seqNum, payload);
+        ++snapshotCnt;
+        if(snapshot.size() >= WAL_CHUNK_SIZE)
+        {
+            if(!writeAll(tmpFd, snapshot))
+            {
+                fail("compaction write");
+            }
+            snapshot.clear();
+        }
+    }
+
+    // append the records logged meanwhile, and replace the log with the new one
+    void endCompaction()
+    {
+        if(!writeAll(tmpFd, snapshot))
+        {
+            fail("compaction write");
+        }
+        snapshot.clear();
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            if(!writeAll(tmpFd, sideBuf) || fdatasync(tmpFd) != 0)
+            {
+                fail("compaction write");
+            }
+            {
+                std::unique_lock<std::mutex> lck(io_mtx);
+                if(rename(tmpPath.c_str(), path.c_str()) != 0)
+                {
+                    fail("compaction rename");
+                }
+                syncDirectory();
+                close(fd);
+                fd = tmpFd;
+                tmpFd = -1;
+                ++epoch;
+            }
+            // every queued record is in sideBuf, already synced to the new log
+            buffer.clear();
+            durableLsn = appendedLsn;
+            recordCnt = snapshotCnt + sideCnt;
+            sideBuf.clear();
+            compacting = false;
+        }
+        durableCond.notify_all();
+        runDurableCallbacks();
+    }
+
+    // records in the log, including queued ones
+    size_t size()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        return recordCnt;
+    }
+
+    ~WriteAheadLog() noexcept
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            stopped = true;
+        }
+        cond.notify_one();
+        syncThread.join();
+        close(fd);
+    }
+
+private:
+    const std::string path;
+    int fd;
+    std::mutex mtx; // guard everything below except snapshot, always locked before io_mtx
+    std::mutex io_mtx; // guard writes to fd and its replacement
+    std::condition_variable cond; // records queued, or stopped
+    std::condition_variable durableCond; // durableLsn moved
+    std::vector<std::pair<uint64_t, std::function<void()>>> durableCallbacks; // lsn and callback of whenDurable(), not on disk yet
+    std::string buffer; // records queued for the next group commit
+    uint64_t appendedLsn;
+    uint64_t durableLsn;
+    size_t recordCnt; // records in the log, compaction is due once it's large
+    unsigned epoch; // bumped whenever fd is replaced by a compacted log
+    bool stopped;
+    std::thread syncThread;
+
+    // compaction state
+    bool compacting;
+    std::string tmpPath;
+    int tmpFd;
+    std::string snapshot; // snapshot records not written to tmpFd yet, only touched by the compacting thread
+    std::string sideBuf; // records appended since the compaction began
+    size_t snapshotCnt;
+    size_t sideCnt;
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef WRITE_BEHIND_QUEUE_HPP__
+#define WRITE_BEHIND_QUEUE_HPP__
+
+#include "UA.pb.h"
+#include "logger.hpp"
+#include "databaseLogger.hpp"
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include <pqxx/pqxx>
+#define WRITE_BEHIND_CAPACITY 65536
+#define WRITE_BEHIND_BATCH_SIZE 1024
+#define WRITE_BEHIND_BATCH_MS 5
+#define WRITE_BEHIND_RETRY_NUM 7
+#define WRITE_BEHIND_RETRY_MS 50
+
+// package events written to the database by one background writer, handlers only queue them and never wait on a commit
+// events queued within WRITE_BEHIND_BATCH_MS(up to WRITE_BEHIND_BATCH_SIZE of them) are written by one transaction, group commit
+// the single writer applies events in queue order, so events of one package reach the database in the order they were queued
+// at most WRITE_BEHIND_CAPACITY events are queued, a handler queuing more waits for the writer(backpressure)
+// a write failing on a broken connection is retried WRITE_BEHIND_RETRY_NUM times with backoff(WRITE_BEHIND_RETRY_MS doubled
+// each time, 6.35s in total) while the pool re-opens its connections
+// if a batch still fails, its events are retried one transaction each, so one bad event only loses itself
+// a queued event lives only in memory, so whatever depends on it being durable, like recording its request as handled
+// and acking it, is passed as onWritten and called by the writer once the event is committed; an event given up is
+// dropped and its onDropped is called instead, like to release the claim of its request so a retransmission is handled again
+// a read of packages created through the queue calls waitCreated() first, which only waits for the events creating them
+class WriteBehindQueue
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event
+    {
+        Event() : type { 0 }, state { 0 }, seq { 0 }, dropped { false } {}
+
+        enum : unsigned
+        {
+            CREATE_PICKUP = 0,
+            UPDATE_PKG_STATES = 1,
+        };
+
+        unsigned type;
+        AtoUPickupRequest pickupReq; // CREATE_PICKUP
+        std::vector<int> packageIds; // UPDATE_PKG_STATES
+        int state;
+        std::function<void()> onWritten; // none if empty
+        std::function<void()> onDropped; // none if empty
+        uint64_t seq; // queuedCnt once it's queued, written when writtenCnt reaches it
+        bool dropped; // given up by write()
+    };
+
+    void post(Event && event)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        notFull.wait(lck, [this](){ return events.size() < WRITE_BEHIND_CAPACITY; });
+        event.seq = ++queuedCnt;
+        if(event.type == Event::CREATE_PICKUP)
+        {
+            for(const ShipInfo & shipment : event.pickupReq.shipment())
+            {
+                pendingPackages[shipment.shipid()] = event.seq;
+            }
+        }
+        events.push_back(std::move(event));
+        notEmpty.notify_one();
+    }
+
+    void apply(pqxx::work & W, const Event & event)
+    {
+        if(event.type == Event::CREATE_PICKUP)
+        {
+            dbConn->createPickup(W, event.pickupReq);
+        }
+        else
+        {
+            dbConn->updatePkgStates(W, event.packageIds, event.state);
+        }
+    }
+
+    // what the event writes, for the error log
+    std::string describe(const Event & event) const
+    {
+        std::ostringstream desc;
+        if(event.type == Event::CREATE_PICKUP)
+        {
+            desc << "event " << event.seq << ": create pickup of request " << event.pickupReq.seqnum() << ", packages";
+            for(const ShipInfo & shipment : event.pickupReq.shipment())
+            {
+                desc << " " << shipment.shipid();
+            }
+        }
+        else
+        {
+            desc << "event " << event.seq << ": set state " << event.state << " of packages";
+            for(int packageId : event.packageIds)
+            {
+                desc << " " << packageId;
+            }
+        }
+        return desc.str();
+    }
+
+    // commit fn(W) in one transaction, retried with backoff while the connection is broken,
+    // false with the error in what if it still fails(broken set), or fails otherwise
+    template<typename Fn>
+    bool commit(Fn fn, std::string & what, bool & broken)
+    {
+        broken = false;
+        unsigned delayMs = WRITE_BEHIND_RETRY_MS;
+        for(unsigned retries = 0; ; ++retries)
+        {
+            try
+            {
+                dbConn->transact(fn);
+                return true;
+            }
+            catch(pqxx::broken_connection & e)
+            {
+                what = e.what();
+                if(retries == WRITE_BEHIND_RETRY_NUM)
+                {
+                    broken = true;
+                    return false;
+                }
+            }
+            catch(std::exception & e)
+            {
+                what = e.what();
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+            delayMs *= 2;
+        }
+    }
+
+    // commit the batch, an event that can't be committed is marked dropped
+    void write(std::vector<Event> & batch)
+    {
+        std::string what;
+        bool broken;
+        bool committed = commit([this, &batch](pqxx::work & W)
+        {
+            for(const Event & event : batch)
+            {
+                apply(W, event);
+            }
+        }, what, broken);
+        if(committed)
+        {
+            return;
+        }
+        // the database is still unreachable after the backoff, don't wait it out again for every event
+        Logger::getInstance()->log("error.log", "Write-behind batch of ", batch.size(), " events failed: ", what,
+                                   broken ? ", drop them" : ", retry one by one");
+        for(Event & event : batch)
+        {
+            if(broken || !commit([this, &event](pqxx::work & W) { apply(W, event); }, what, broken))
+            {
+                event.dropped = true;
+                Logger::getInstance()->log("error.log", "Write-behind event dropped: ", what, ", ", describe(event));
+            }
+        }
+    }
+
+    // wait with the lock held until the event target, and every event before it, has been written
+    void waitWritten(std::unique_lock<std::mutex> & lck, uint64_t target)
+    {
+        if(writtenCnt >= target)
+        {
+            return;
+        }
+        ++flushWaiters;
+        notEmpty.notify_one();
+        written.wait(lck, [this, target](){ return writtenCnt >= target; });
+        --flushWaiters;
+    }
+
+    // background writer, one batch at a time until stopped and drained
+    void run()
+    {
+        std::vector<Event> batch;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                notEmpty.wait(lck, [this](){ return stop || !events.empty(); });
+                if(events.empty())
+                {
+                    return; // stopped and drained
+                }
+                // give the batch WRITE_BEHIND_BATCH_MS to fill up, unless a flush is waiting or it's full already
+                Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(WRITE_BEHIND_BATCH_MS);
+                notEmpty.wait_until(lck, deadline, [this]()
+                {
+                    return stop || flushWaiters > 0 || events.size() >= WRITE_BEHIND_BATCH_SIZE;
+                });
+                size_t batchSize = std::min<size_t>(events.size(), WRITE_BEHIND_BATCH_SIZE);
+                for(size_t idx = 0; idx < batchSize; ++idx)
+                {
+                    batch.push_back(std::move(events.front()));
+                    events.pop_front();
+                }
+                notFull.notify_all();
+            }
+            write(batch);
+            for(Event & event : batch)
+            {
+                std::function<void()> & then = event.dropped ? event.onDropped : event.onWritten;
+                if(then)
+                {
+                    then();
+                }
+            }
+            {
+                std::unique_lock<std::mutex> lck(mtx);
+                writtenCnt += batch.size();
+                for(const Event & event : batch)
+                {
+                    if(event.type != Event::CREATE_PICKUP)
+                    {
+                        continue;
+                    }
+                    for(const ShipInfo & shipment : event.pickupReq.shipment())
+                    {
+                        auto it = pendingPackages.find(shipment.shipid());
+                        if(it != pendingPackages.end() && it->second == event.seq) // or created again by a later event
+                        {
+                            pendingPackages.erase(it);
+                        }
+                    }
+                }
+                written.notify_all();
+            }
+            batch.clear();
+        }
+    }
+
+public:
+    explicit WriteBehindQueue(DatabaseLogger * _dbConn) :
+        dbConn { _dbConn },
+        stop { false },
+        queuedCnt { 0 },
+        writtenCnt { 0 },
+        flushWaiters { 0 },
+        writer { &WriteBehindQueue::run, this }
+        {}
+
+    WriteBehindQueue(const WriteBehindQueue &) = delete;
+    WriteBehindQueue & operator=(const WriteBehindQueue &) = delete;
+
+    void createPickup(const AtoUPickupRequest & pickupReq, std::function<void()> onWritten = nullptr,
+                      std::function<void()> onDropped = nullptr)
+    {
+        Event event;
+        event.type = Event::CREATE_PICKUP;
+        event.pickupReq = pickupReq;
+        event.onWritten = std::move(onWritten);
+        event.onDropped = std::move(onDropped);
+        post(std::move(event));
+    }
+
+    void updatePkgStates(const std::vector<int> & packageIds, int newState, std::function<void()> onWritten = nullptr,
+                         std::function<void()> onDropped = nullptr)
+    {
+        Event event;
+        event.type = Event::UPDATE_PKG_STATES;
+        event.packageIds = packageIds;
+        event.state = newState;
+        event.onWritten = std::move(onWritten);
+        event.onDropped = std::move(onDropped);
+        post(std::move(event));
+    }
+
+    void updatePkgState(int packageId, int newState, std::function<void()> onWritten = nullptr,
+                        std::function<void()> onDropped = nullptr)
+    {
+        updatePkgStates(std::vector<int>(1, packageId), newState, std::move(onWritten), std::move(onDropped));
+    }
+
+    // wait until every event queued before the call has been written(or dropped)
+    void flush()
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        waitWritten(lck, queuedCnt);
+    }
+
+    // wait until the events creating packageIds have been written(or dropped), not for anything queued after them,
+    // returns at once if none of them is queued
+    void waitCreated(const std::vector<int> & packageIds)
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        uint64_t target = 0;
+        for(int packageId : packageIds)
+        {
+            auto it = pendingPackages.find(packageId);
+            if(it != pendingPackages.end())
+            {
+                target = std::max(target, it->second);
+            }
+        }
+        waitWritten(lck, target);
+    }
+
+    // every queued event is written before the writer exits
+    ~WriteBehindQueue() noexcept
+    {
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            stop = true;
+            notEmpty.notify_one();
+        }
+        writer.join();
+    }
+
+private:
+    DatabaseLogger * dbConn;
+    std::mutex mtx;
+    std::condition_variable notEmpty; // events queued, stop or flush requested
+    std::condition_variable notFull;
+    std::condition_variable written; // a batch has been written
+    std::deque<Event> events;
+    bool stop;
+    uint64_t queuedCnt; // events ever queued
+    uint64_t writtenCnt; // events ever written or dropped
+    unsigned flushWaiters; // threads waiting for an event to be written, the writer doesn't wait for its batch to fill up
+    std::unordered_map<int, uint64_t> pendingPackages; // package id as key, seq of the queued event creating it as value
+    std::thread writer; // started last, after every other member
+};
+
+#endif